@@ -1,35 +1,134 @@
 #include "termkey.h"
 #include "termkey-internal.h"
 
+#include <limits.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#ifndef _WIN32
+# include <unistd.h>
+#endif
+#include <sys/types.h>
+#include <sys/stat.h>
 
 // There are 64 codes 0x40 - 0x7F
 static int keyinfo_initialised = 0;
 static struct keyinfo ss3s[64];
 static char ss3_kpalts[64];
 
+#define CSI_MAXARGS    32
+#define CSI_MAXSUBARGS 8  // Per argument
+#define CSI_MAXVALUE   (LONG_MAX / 10) // Larger numbers are taken as this
+
+/* Colon-separated sub-parameters, such as the 65 in "CSI 97:65;2u". Those of
+ * argument i are args[idx[i]] up to args[idx[i+1]]; an empty one is -1. Any
+ * beyond CSI_MAXSUBARGS in one argument are dropped, so a long list can't
+ * crowd out those of the arguments after it
+ */
+struct CsiSubArgs {
+  unsigned short idx[CSI_MAXARGS + 1];
+  long args[CSI_MAXARGS * CSI_MAXSUBARGS];
+};
+
+struct CsiParse {
+  size_t pos;           // Next byte to look at
+  char done;            // Found the command byte
+  char argsdone;        // Stopped collecting arguments
+  char present;         // The current argument or sub-parameter has digits
+  char started;         // The current argument has digits or sub-parameters
+  char insub;           // Digits are for: 0 the argument, 1 its last sub-parameter, 2 nothing
+  int argi;
+  int nsubargs;
+  long args[CSI_MAXARGS];
+  struct CsiSubArgs sub;
+  unsigned long command;
+};
+
 typedef struct {
   TermKey *tk;
   int saved_string_id;
   char *saved_string;
+
+  /* The most recent unknown CSI, as parsed, for termkey_interpret_csi(). Its
+   * key event carries saved_csi_id so an older one isn't given these args */
+  char saved_csi_valid;
+  int saved_csi_id;
+  unsigned long saved_csi_cmd;
+  size_t saved_csi_nargs;
+  long saved_csi_args[CSI_MAXARGS];
+  struct CsiSubArgs saved_csi_sub;
+
+  /* An incomplete CSI or control string at the head of the buffer is only
+   * scanned as far as the bytes go. This remembers how far that got, keyed
+   * by the stream offset and introducer length it was found at, so the scan
+   * can resume there rather than start over when more bytes arrive
+   */
+  char scan_valid;
+  size_t scan_start;
+  size_t scan_introlen;
+  struct CsiParse csiparse;
+  size_t strscan;       // Next byte at which a string terminator might be
+
+  int paste_id;
+  const char *paste;    // Body of the most recent paste event
+  size_t paste_len;
+  char paste_more;      // That paste event was partial; more of it follows
+  char in_paste;        // The paste continues with the bytes at paste_resume
+  size_t paste_resume;  // Stream offset (as buffpos) where the paste continues
+  const char *paste_end;
+  char peeked_paste;    // A paste event was peeked, ending at peeked_paste_resume
+  char peeked_paste_more;
+  size_t peeked_paste_resume;
+  const char *peeked_paste_end;
+  char *paste_copy;     // Holds a paste body that wrapped around the buffer
+  size_t paste_copysize;
+
+  char kitty_pushed;    // The kitty keyboard flags were pushed on the terminal
 } TermKeyCsi;
 
-typedef TermKeyResult CsiHandler(TermKey *tk, TermKeyKey *key, int cmd, long *arg, int args);
+static const char paste_end_7bit[] = "\x1b[201~";
+static const char paste_end_8bit[] = "\x9b" "201~";
+
+typedef TermKeyResult CsiHandler(TermKey *tk, TermKeyKey *key, int cmd, long *arg, int args, const struct CsiSubArgs *sub);
 static CsiHandler *csi_handlers[64];
 
+/* Modifiers are given as 1 more than a bitmask in the second argument; the
+ * kitty keyboard protocol adds the event type as a sub-parameter of it
+ */
+static int csi_modifiers(TermKey *tk, TermKeyKey *key, long *arg, int args, const struct CsiSubArgs *sub)
+{
+  if(args < 2)
+    return 0;
+
+  if(sub->idx[2] > sub->idx[1])
+    switch(sub->args[sub->idx[1]]) {
+      case 2:
+        key->event = TERMKEY_KEYEVENT_REPEAT;
+        break;
+      case 3:
+        key->event = TERMKEY_KEYEVENT_RELEASE;
+        break;
+    }
+
+  if(arg[1] == -1)
+    return 0;
+
+  int mod = arg[1] - 1;
+  if(!(tk->canonflags & TERMKEY_CANON_LOCKMODS))
+    mod &= ~(TERMKEY_KEYMOD_CAPSLOCK|TERMKEY_KEYMOD_NUMLOCK);
+
+  return mod;
+}
+
 /*
  * Handler for CSI/SS3 cmd keys
  */
 
 static struct keyinfo csi_ss3s[64];
 
-static TermKeyResult handle_csi_ss3_full(TermKey *tk, TermKeyKey *key, int cmd, long *arg, int args)
+static TermKeyResult handle_csi_ss3_full(TermKey *tk, TermKeyKey *key, int cmd, long *arg, int args, const struct CsiSubArgs *sub)
 {
-  if(args > 1 && arg[1] != -1)
-    key->modifiers = arg[1] - 1;
-  else
-    key->modifiers = 0;
+  key->modifiers = csi_modifiers(tk, key, arg, args, sub);
 
   key->type = csi_ss3s[cmd - 0x40].type;
   key->code.sym = csi_ss3s[cmd - 0x40].sym;
@@ -85,12 +184,9 @@ static void register_ss3kpalt(TermKeyType type, TermKeySym sym, unsigned char cm
 static struct keyinfo csifuncs[35]; /* This value must be increased if more CSI function keys are added */
 #define NCSIFUNCS (sizeof(csifuncs)/sizeof(csifuncs[0]))
 
-static TermKeyResult handle_csifunc(TermKey *tk, TermKeyKey *key, int cmd, long *arg, int args)
+static TermKeyResult handle_csifunc(TermKey *tk, TermKeyKey *key, int cmd, long *arg, int args, const struct CsiSubArgs *sub)
 {
-  if(args > 1 && arg[1] != -1)
-    key->modifiers = arg[1] - 1;
-  else
-    key->modifiers = 0;
+  key->modifiers = csi_modifiers(tk, key, arg, args, sub);
 
   key->type = TERMKEY_TYPE_KEYSYM;
 
@@ -133,25 +229,131 @@ static void register_csifunc(TermKeyType type, TermKeySym sym, int number)
 }
 
 /*
- * Handler for CSI u extended Unicode keys
+ * Handler for CSI u extended Unicode keys, and the kitty keyboard protocol
  */
 
-static TermKeyResult handle_csi_u(TermKey *tk, TermKeyKey *key, int cmd, long *arg, int args)
+/* The kitty protocol's functional keys without a legacy encoding, numbered
+ * in a Private Use Area. Those without a TermKeySym are left as unknown CSIs
+ */
+#define KITTY_F13    57376
+#define KITTY_F35    57398
+
+static const struct kittyfunc {
+  long number;
+  TermKeySym sym;
+  char kpalt;
+} kittyfuncs[] = {
+  /* THIS LIST MUST REMAIN SORTED! */
+  { 57361, TERMKEY_SYM_PRINT },
+  { 57399, TERMKEY_SYM_KP0,      '0' },
+  { 57400, TERMKEY_SYM_KP1,      '1' },
+  { 57401, TERMKEY_SYM_KP2,      '2' },
+  { 57402, TERMKEY_SYM_KP3,      '3' },
+  { 57403, TERMKEY_SYM_KP4,      '4' },
+  { 57404, TERMKEY_SYM_KP5,      '5' },
+  { 57405, TERMKEY_SYM_KP6,      '6' },
+  { 57406, TERMKEY_SYM_KP7,      '7' },
+  { 57407, TERMKEY_SYM_KP8,      '8' },
+  { 57408, TERMKEY_SYM_KP9,      '9' },
+  { 57409, TERMKEY_SYM_KPPERIOD, '.' },
+  { 57410, TERMKEY_SYM_KPDIV,    '/' },
+  { 57411, TERMKEY_SYM_KPMULT,   '*' },
+  { 57412, TERMKEY_SYM_KPMINUS,  '-' },
+  { 57413, TERMKEY_SYM_KPPLUS,   '+' },
+  { 57414, TERMKEY_SYM_KPENTER },
+  { 57415, TERMKEY_SYM_KPEQUALS, '=' },
+  { 57416, TERMKEY_SYM_KPCOMMA,  ',' },
+  { 57417, TERMKEY_SYM_LEFT },
+  { 57418, TERMKEY_SYM_RIGHT },
+  { 57419, TERMKEY_SYM_UP },
+  { 57420, TERMKEY_SYM_DOWN },
+  { 57421, TERMKEY_SYM_PAGEUP },
+  { 57422, TERMKEY_SYM_PAGEDOWN },
+  { 57423, TERMKEY_SYM_HOME },
+  { 57424, TERMKEY_SYM_END },
+  { 57425, TERMKEY_SYM_INSERT },
+  { 57426, TERMKEY_SYM_DELETE },
+  { 57427, TERMKEY_SYM_BEGIN },
+};
+
+static int kittyfunc_cmp(const void *number, const void *func)
+{
+  long n = *(const long *)number;
+  long m = ((const struct kittyfunc *)func)->number;
+  return (n > m) - (n < m);
+}
+
+static TermKeyResult handle_kittyfunc(TermKey *tk, TermKeyKey *key, long number)
+{
+  if(number >= KITTY_F13 && number <= KITTY_F35) {
+    key->type = TERMKEY_TYPE_FUNCTION;
+    key->code.number = 13 + number - KITTY_F13;
+    return TERMKEY_RES_KEY;
+  }
+
+  const struct kittyfunc *func = bsearch(&number, kittyfuncs,
+      sizeof kittyfuncs / sizeof kittyfuncs[0], sizeof kittyfuncs[0], &kittyfunc_cmp);
+  if(!func)
+    return TERMKEY_RES_NONE;
+
+  if(tk->flags & TERMKEY_FLAG_CONVERTKP && func->kpalt) {
+    int mod = key->modifiers;
+    (*tk->method.emit_codepoint)(tk, func->kpalt, key);
+    key->modifiers |= mod;
+    return TERMKEY_RES_KEY;
+  }
+
+  key->type = TERMKEY_TYPE_KEYSYM;
+  key->code.sym = func->sym;
+  return TERMKEY_RES_KEY;
+}
+
+static TermKeyResult handle_csi_u(TermKey *tk, TermKeyKey *key, int cmd, long *arg, int args, const struct CsiSubArgs *sub)
 {
   switch(cmd) {
     case 'u': {
-      if(args > 1 && arg[1] != -1)
-        key->modifiers = arg[1] - 1;
-      else
-        key->modifiers = 0;
+      if(args < 1 || arg[0] < 0)
+        return TERMKEY_RES_NONE;
+
+      int mod = csi_modifiers(tk, key, arg, args, sub);
+      long codepoint = arg[0];
+
+      if(codepoint >= 0xE000 && codepoint < 0xF900) {
+        key->modifiers = mod;
+        return handle_kittyfunc(tk, key, codepoint);
+      }
+
+      /* The text a key types, when it is a single character, is what it is
+       * reported as; that covers Caps Lock too. Otherwise a shifted key can
+       * come with the key it makes as an alternate. Either way a shifted key
+       * is reported, as legacy input would be, without the Shift
+       */
+      long text = -1, shifted = -1;
+      if(args > 2 && arg[2] > 0 && sub->idx[3] == sub->idx[2])
+        text = arg[2];
+      if(args > 0 && sub->idx[1] > sub->idx[0])
+        shifted = sub->args[sub->idx[0]];
+
+      if(text > 0) {
+        codepoint = text;
+        mod &= ~TERMKEY_KEYMOD_SHIFT;
+      }
+      else if((mod & TERMKEY_KEYMOD_SHIFT) && shifted > 0) {
+        codepoint = shifted;
+        mod &= ~TERMKEY_KEYMOD_SHIFT;
+      }
 
-      int mod = key->modifiers;
       key->type = TERMKEY_TYPE_KEYSYM;
-      (*tk->method.emit_codepoint)(tk, arg[0], key);
+      (*tk->method.emit_codepoint)(tk, codepoint, key);
       key->modifiers |= mod;
 
       return TERMKEY_RES_KEY;
     }
+    case 'u'|'?'<<8:
+      key->type = TERMKEY_TYPE_KITTYFLAGS;
+      key->code.number = args > 0 && arg[0] != -1 ? arg[0] : 0;
+      key->modifiers = 0;
+      return TERMKEY_RES_KEY;
     default:
       return TERMKEY_RES_NONE;
   }
@@ -162,7 +364,7 @@ static TermKeyResult handle_csi_u(TermKey *tk, TermKeyKey *key, int cmd, long *a
  * Note: This does not handle X10 encoding
  */
 
-static TermKeyResult handle_csi_m(TermKey *tk, TermKeyKey *key, int cmd, long *arg, int args)
+static TermKeyResult handle_csi_m(TermKey *tk, TermKeyKey *key, int cmd, long *arg, int args, const struct CsiSubArgs *sub)
 {
   int initial = cmd >> 8;
   cmd &= 0xff;
@@ -265,7 +467,7 @@ TermKeyResult termkey_interpret_mouse(TermKey *tk, const TermKeyKey *key, TermKe
  * A plain CSI R with no arguments is probably actually <F3>
  */
 
-static TermKeyResult handle_csi_R(TermKey *tk, TermKeyKey *key, int cmd, long *arg, int args)
+static TermKeyResult handle_csi_R(TermKey *tk, TermKeyKey *key, int cmd, long *arg, int args, const struct CsiSubArgs *sub)
 {
   switch(cmd) {
     case 'R'|'?'<<8:
@@ -277,7 +479,7 @@ static TermKeyResult handle_csi_R(TermKey *tk, TermKeyKey *key, int cmd, long *a
       return TERMKEY_RES_KEY;
 
     default:
-      return handle_csi_ss3_full(tk, key, cmd, arg, args);
+      return handle_csi_ss3_full(tk, key, cmd, arg, args, sub);
   }
 }
 
@@ -295,7 +497,7 @@ TermKeyResult termkey_interpret_position(TermKey *tk, const TermKeyKey *key, int
  * Handler for CSI $y mode status reports
  */
 
-static TermKeyResult handle_csi_y(TermKey *tk, TermKeyKey *key, int cmd, long *arg, int args)
+static TermKeyResult handle_csi_y(TermKey *tk, TermKeyKey *key, int cmd, long *arg, int args, const struct CsiSubArgs *sub)
 {
   switch(cmd) {
     case 'y'|'$'<<16:
@@ -332,84 +534,168 @@ TermKeyResult termkey_interpret_modereport(TermKey *tk, const TermKeyKey *key, i
   return TERMKEY_RES_KEY;
 }
 
-#define CHARAT(i) (tk->buffer[tk->buffstart + (i)])
-
-static TermKeyResult parse_csi(TermKey *tk, size_t introlen, size_t *csi_len, long args[], size_t *nargs, unsigned long *commandp)
+/* Parses a CSI a byte at a time, so that when it is incomplete the work done
+ * so far can be kept and carried on with once more bytes arrive
+ */
+static void csi_parse_init(struct CsiParse *st, size_t introlen)
 {
-  size_t csi_end = introlen;
+  st->pos      = introlen;
+  st->done     = 0;
+  st->argsdone = 0;
+  st->present  = 0;
+  st->started  = 0;
+  st->insub    = 0;
+  st->argi     = 0;
+  st->nsubargs = 0;
+  st->args[0]  = -1;
+  st->sub.idx[0] = 0;
+  st->command  = 0;
+}
 
-  while(csi_end < tk->buffcount) {
-    if(CHARAT(csi_end) >= 0x40 && CHARAT(csi_end) < 0x80)
-      break;
-    csi_end++;
+static long *csi_parse_digits(struct CsiParse *st)
+{
+  switch(st->insub) {
+    case 0:  return &st->args[st->argi];
+    case 1:  return &st->sub.args[st->nsubargs - 1];
+    default: return NULL;
   }
+}
 
-  if(csi_end >= tk->buffcount)
-    return TERMKEY_RES_AGAIN;
-
-  unsigned char cmd = CHARAT(csi_end);
-  *commandp = cmd;
-
-  char present = 0;
-  int argi = 0;
-
-  size_t p = introlen;
-
-  // See if there is an initial byte
-  if(CHARAT(p) >= '<' && CHARAT(p) <= '?') {
-    *commandp |= (CHARAT(p) << 8);
-    p++;
-  }
+static TermKeyResult csi_parse_resume(TermKey *tk, struct CsiParse *st, size_t introlen)
+{
+  while(!st->done && st->pos < tk->buffcount) {
+    unsigned char c = CHARAT(st->pos);
 
-  // Now attempt to parse out up number;number;... separated values
-  while(p < csi_end) {
-    unsigned char c = CHARAT(p);
+    if(c >= 0x40 && c < 0x80) {
+      st->command |= c;
+      st->done = 1;
 
-    if(c >= '0' && c <= '9') {
-      if(!present) {
-        args[argi] = c - '0';
-        present = 1;
-      }
-      else {
-        args[argi] = (args[argi] * 10) + c - '0';
+      if(st->started)
+        st->argi++;
+      st->sub.idx[st->argi] = st->nsubargs;
+    }
+    else if(st->pos == introlen && c >= '<' && c <= '?') {
+      // An initial byte
+      st->command |= c << 8;
+    }
+    else if(st->argsdone) {
+      // Ignore anything else until the command byte
+    }
+    else if(c >= '0' && c <= '9') {
+      // Now attempt to parse out up number:sub:sub;number;... separated values
+      long *v = csi_parse_digits(st);
+      if(v && !st->present)
+        *v = c - '0';
+      else if(v)
+        *v = *v > (CSI_MAXVALUE - (c - '0')) / 10 ? CSI_MAXVALUE : *v * 10 + c - '0';
+      st->present = 1;
+      st->started = 1;
+    }
+    else if(c == ':') {
+      if(st->nsubargs - st->sub.idx[st->argi] < CSI_MAXSUBARGS) {
+        st->sub.args[st->nsubargs++] = -1;
+        st->insub = 1;
       }
+      else
+        st->insub = 2;
+      st->present = 0;
+      st->started = 1;
     }
     else if(c == ';') {
-      if(!present)
-        args[argi] = -1;
-      present = 0;
-      argi++;
-
-      if(argi > 16)
-        break;
+      st->present = 0;
+      st->started = 0;
+      st->insub = 0;
+      st->argi++;
+      st->sub.idx[st->argi] = st->nsubargs;
+
+      if(st->argi >= CSI_MAXARGS)
+        st->argsdone = 1;
+      else
+        st->args[st->argi] = -1;
     }
     else if(c >= 0x20 && c <= 0x2f) {
-      *commandp |= c << 16;
-      break;
+      st->command |= c << 16;
+      st->argsdone = 1;
     }
 
-    p++;
+    st->pos++;
   }
 
-  if(present)
-    argi++;
+  return st->done ? TERMKEY_RES_KEY : TERMKEY_RES_AGAIN;
+}
+
+static void csi_parse_result(const struct CsiParse *st, size_t *csi_len, long args[], size_t *nargs, unsigned long *commandp)
+{
+  for(int i = 0; i < st->argi; i++)
+    args[i] = st->args[i];
 
-  *nargs = argi;
-  *csi_len = csi_end + 1;
+  *nargs = st->argi;
+  *commandp = st->command;
+  *csi_len = st->pos;
+}
 
-  return TERMKEY_RES_KEY;
+/* Returns the CSI driver's record of key, if key is the most recent unknown
+ * CSI it read
+ */
+static TermKeyCsi *saved_csi_for(TermKey *tk, const TermKeyKey *key)
+{
+  struct TermKeyDriverNode *p;
+  for(p = tk->drivers; p; p = p->next)
+    if(p->driver == &termkey_driver_csi)
+      break;
+
+  if(!p)
+    return NULL;
+
+  if(key->type != TERMKEY_TYPE_UNKNOWN_CSI)
+    return NULL;
+
+  TermKeyCsi *csi = p->info;
+  int id;
+  memcpy(&id, key->utf8 + 1, sizeof id);
+
+  if(!csi->saved_csi_valid || csi->saved_csi_id != id ||
+     csi->saved_csi_cmd != key->code.number)
+    return NULL;
+
+  return csi;
 }
 
 TermKeyResult termkey_interpret_csi(TermKey *tk, const TermKeyKey *key, long args[], size_t *nargs, unsigned long *cmd)
 {
-  size_t dummy;
+  TermKeyCsi *csi = saved_csi_for(tk, key);
 
-  if(tk->hightide == 0)
+  if(!csi)
     return TERMKEY_RES_NONE;
-  if(key->type != TERMKEY_TYPE_UNKNOWN_CSI)
+
+  if(*nargs > csi->saved_csi_nargs)
+    *nargs = csi->saved_csi_nargs;
+
+  memcpy(args, csi->saved_csi_args, *nargs * sizeof args[0]);
+  *cmd = csi->saved_csi_cmd;
+
+  return TERMKEY_RES_KEY;
+}
+
+TermKeyResult termkey_interpret_csi_subargs(TermKey *tk, const TermKeyKey *key, size_t argi, long subargs[], size_t *nsubargs)
+{
+  TermKeyCsi *csi = saved_csi_for(tk, key);
+
+  if(!csi)
+    return TERMKEY_RES_NONE;
+
+  if(argi >= csi->saved_csi_nargs)
     return TERMKEY_RES_NONE;
 
-  return parse_csi(tk, 0, &dummy, args, nargs, cmd);
+  const struct CsiSubArgs *sub = &csi->saved_csi_sub;
+  size_t n = sub->idx[argi + 1] - sub->idx[argi];
+
+  if(*nsubargs > n)
+    *nsubargs = n;
+
+  memcpy(subargs, sub->args + sub->idx[argi], *nsubargs * sizeof subargs[0]);
+
+  return TERMKEY_RES_KEY;
 }
 
 static int register_keys(void)
@@ -515,6 +801,24 @@ static void *new_driver(TermKey *tk, const char *term)
   csi->saved_string_id = 0;
   csi->saved_string = NULL;
 
+  csi->saved_csi_valid = 0;
+  csi->saved_csi_id = 0;
+
+  csi->kitty_pushed = 0;
+
+  csi->scan_valid = 0;
+
+  csi->paste_id = 0;
+  csi->paste = NULL;
+  csi->paste_len = 0;
+  csi->paste_more = 0;
+  csi->in_paste = 0;
+  csi->paste_resume = 0;
+  csi->paste_end = NULL;
+  csi->peeked_paste = 0;
+  csi->paste_copy = NULL;
+  csi->paste_copysize = 0;
+
   return csi;
 }
 
@@ -525,17 +829,198 @@ static void free_driver(void *info)
   if(csi->saved_string)
     free(csi->saved_string);
 
+  if(csi->paste_copy)
+    free(csi->paste_copy);
+
   free(csi);
 }
 
+/* Returns true if the sequence at the head of the buffer with this introducer
+ * length is the one scanned last time, so the scan can be resumed. Otherwise
+ * notes that it is now the one being scanned, and the caller starts afresh
+ */
+static int resume_scan(TermKey *tk, TermKeyCsi *csi, size_t introlen)
+{
+  if(csi->scan_valid &&
+     csi->scan_start == tk->buffpos &&
+     csi->scan_introlen == introlen)
+    return 1;
+
+  csi->scan_valid = 1;
+  csi->scan_start = tk->buffpos;
+  csi->scan_introlen = introlen;
+
+  return 0;
+}
+
+/* Returns how many bytes at the end of the buffer, after offset start, could
+ * be the beginning of a terminator split across reads
+ */
+static size_t paste_end_held(TermKey *tk, size_t start, const char *end, size_t endlen)
+{
+  size_t hold = endlen - 1;
+  if(hold > tk->buffcount - start)
+    hold = tk->buffcount - start;
+
+  for(; hold; hold--) {
+    size_t i;
+    for(i = 0; i < hold; i++)
+      if(CHARAT(tk->buffcount - hold + i) != (unsigned char)end[i])
+        break;
+    if(i == hold)
+      break;
+  }
+
+  return hold;
+}
+
+/* This may only be a peek; the paste only continues past the event once its
+ * bytes are eaten. See peekkey()
+ */
+static void peeked_paste(TermKey *tk, TermKeyCsi *csi, TermKeyType type, const char *end, int continues, size_t nbytes, TermKeyKey *key)
+{
+  csi->peeked_paste = 1;
+  csi->peeked_paste_more = continues;
+  tk->driver_pending = 1;
+  csi->peeked_paste_resume = tk->buffpos + nbytes;
+  csi->peeked_paste_end = end;
+
+  key->type = type;
+  key->code.number = ++csi->paste_id;
+  key->modifiers = 0;
+}
+
+/* A bracketed paste body runs from offset start up to the terminator string
+ * end. The whole body is returned as one event once the terminator arrives.
+ * If it can't, because the buffer is full or the caller is forcing, whatever
+ * has arrived so far is returned and the rest continues in later events
+ */
+static TermKeyResult peekkey_paste(TermKey *tk, TermKeyCsi *csi, size_t start, const char *end, TermKeyKey *key, int force, size_t *nbytep)
+{
+  size_t endlen = strlen(end);
+  size_t len;
+  int more = 0;
+
+  if(csi->strscan < start)
+    csi->strscan = start;
+
+  size_t endpos = termkey_buffer_find(tk, csi->strscan, end, endlen);
+
+  if(endpos < tk->buffcount) {
+    len = endpos - start;
+    *nbytep = endpos + endlen;
+  }
+  else {
+    // Next time only look again where a split terminator might begin
+    if(tk->buffcount - csi->strscan >= endlen)
+      csi->strscan = tk->buffcount - endlen + 1;
+
+    if(!force && tk->buffcount < tk->buffsize)
+      return TERMKEY_RES_AGAIN;
+
+    size_t hold = paste_end_held(tk, start, end, endlen);
+
+    len = tk->buffcount - start - hold;
+    if(!len && !force)
+      return TERMKEY_RES_AGAIN;
+    if(!len)
+      len = hold;
+
+    *nbytep = start + len;
+    more = 1;
+  }
+
+  size_t pos = tk->buffstart + start;
+  if(pos >= tk->buffsize)
+    pos -= tk->buffsize;
+
+  if(pos + len <= tk->buffsize)
+    csi->paste = (const char *)tk->buffer + pos;
+  else {
+    if(len > csi->paste_copysize) {
+      char *copy = realloc(csi->paste_copy, len);
+      if(!copy)
+        return TERMKEY_RES_ERROR;
+      csi->paste_copy = copy;
+      csi->paste_copysize = len;
+    }
+
+    termkey_buffer_copy(tk, start, len, (unsigned char *)csi->paste_copy);
+    csi->paste = csi->paste_copy;
+  }
+
+  csi->paste_len = len;
+  csi->paste_more = more;
+
+  peeked_paste(tk, csi, TERMKEY_TYPE_PASTE, end, more, *nbytep, key);
+
+  return TERMKEY_RES_KEY;
+}
+
+/* With TERMKEY_FLAG_STREAMPASTE, the body of a paste that has been started
+ * is returned in PASTE_DATA chunks of whatever has arrived so far, up to the
+ * terminator, which then gives PASTE_END. Each chunk stops at the end of the
+ * ring so that it is always a view of the buffer, never a copy
+ */
+static TermKeyResult peekkey_paste_stream(TermKey *tk, TermKeyCsi *csi, const char *end, TermKeyKey *key, int force, size_t *nbytep)
+{
+  size_t endlen = strlen(end);
+  size_t len;
+
+  size_t endpos = termkey_buffer_find(tk, 0, end, endlen);
+
+  if(endpos == 0) {
+    *nbytep = endlen;
+    peeked_paste(tk, csi, TERMKEY_TYPE_PASTE_END, end, 0, *nbytep, key);
+    return TERMKEY_RES_KEY;
+  }
+
+  if(endpos < tk->buffcount)
+    len = endpos;
+  else {
+    size_t hold = paste_end_held(tk, 0, end, endlen);
+
+    len = tk->buffcount - hold;
+    if(!len && !force)
+      return TERMKEY_RES_AGAIN;
+    if(!len)
+      len = hold;
+  }
+
+  if(tk->buffstart + len > tk->buffsize)
+    len = tk->buffsize - tk->buffstart;
+
+  csi->paste = (const char *)tk->buffer + tk->buffstart;
+  csi->paste_len = len;
+  csi->paste_more = 0;
+
+  *nbytep = len;
+  peeked_paste(tk, csi, TERMKEY_TYPE_PASTE_DATA, end, 1, *nbytep, key);
+
+  return TERMKEY_RES_KEY;
+}
+
 static TermKeyResult peekkey_csi(TermKey *tk, TermKeyCsi *csi, size_t introlen, TermKeyKey *key, int force, size_t *nbytep)
 {
   size_t csi_len;
-  size_t args = 16;
-  long arg[16];
+  size_t args;
+  long arg[CSI_MAXARGS];
   unsigned long cmd;
 
-  TermKeyResult ret = parse_csi(tk, introlen, &csi_len, arg, &args, &cmd);
+  int wasdone = 0;
+  if(resume_scan(tk, csi, introlen))
+    wasdone = csi->csiparse.done;
+  else
+    csi_parse_init(&csi->csiparse, introlen);
+
+  TermKeyResult ret = csi_parse_resume(tk, &csi->csiparse, introlen);
+  if(ret == TERMKEY_RES_KEY) {
+    csi_parse_result(&csi->csiparse, &csi_len, arg, &args, &cmd);
+
+    // Anything that follows the CSI, such as a paste body, is scanned from here
+    if(!wasdone)
+      csi->strscan = csi_len;
+  }
 
   if(ret == TERMKEY_RES_AGAIN) {
     if(!force)
@@ -548,13 +1033,11 @@ static TermKeyResult peekkey_csi(TermKey *tk, TermKeyCsi *csi, size_t introlen,
   }
 
   if(cmd == 'M' && args < 3) { // Mouse in X10 encoding consumes the next 3 bytes also
-    tk->buffstart += csi_len;
-    tk->buffcount -= csi_len;
+    termkey_buffer_skip(tk, csi_len);
 
     TermKeyResult mouse_result = (*tk->method.peekkey_mouse)(tk, key, nbytep);
 
-    tk->buffstart -= csi_len;
-    tk->buffcount += csi_len;
+    termkey_buffer_unskip(tk, csi_len);
 
     if(mouse_result == TERMKEY_RES_KEY)
       *nbytep += csi_len;
@@ -562,11 +1045,22 @@ static TermKeyResult peekkey_csi(TermKey *tk, TermKeyCsi *csi, size_t introlen,
     return mouse_result;
   }
 
+  if(cmd == '~' && args == 1 && arg[0] == 200) { // Bracketed paste start
+    const char *end = introlen == 1 ? paste_end_8bit : paste_end_7bit;
+
+    if(!(tk->flags & TERMKEY_FLAG_STREAMPASTE))
+      return peekkey_paste(tk, csi, csi_len, end, key, force, nbytep);
+
+    *nbytep = csi_len;
+    peeked_paste(tk, csi, TERMKEY_TYPE_PASTE_START, end, 1, *nbytep, key);
+    return TERMKEY_RES_KEY;
+  }
+
   TermKeyResult result = TERMKEY_RES_NONE;
 
   // We know from the logic above that cmd must be >= 0x40 and < 0x80
   if(csi_handlers[(cmd & 0xff) - 0x40])
-    result = (*csi_handlers[(cmd & 0xff) - 0x40])(tk, key, cmd, arg, args);
+    result = (*csi_handlers[(cmd & 0xff) - 0x40])(tk, key, cmd, arg, args, &csi->csiparse.sub);
 
   if(result == TERMKEY_RES_NONE) {
 #ifdef DEBUG
@@ -591,9 +1085,21 @@ static TermKeyResult peekkey_csi(TermKey *tk, TermKeyCsi *csi, size_t introlen,
     key->type = TERMKEY_TYPE_UNKNOWN_CSI;
     key->code.number = cmd;
     key->modifiers = 0;
+    key->event = TERMKEY_KEYEVENT_PRESS;
+
+    /* code.number holds the command, so the id goes in the otherwise unused
+     * utf8 bytes, after a NUL that keeps them an empty string */
+    csi->saved_csi_id++;
+    key->utf8[0] = 0;
+    memcpy(key->utf8 + 1, &csi->saved_csi_id, sizeof csi->saved_csi_id);
 
-    tk->hightide = csi_len - introlen;
-    *nbytep = introlen; // Do not yet eat the data bytes
+    csi->saved_csi_valid = 1;
+    csi->saved_csi_cmd = cmd;
+    csi->saved_csi_nargs = args;
+    memcpy(csi->saved_csi_args, arg, args * sizeof arg[0]);
+    csi->saved_csi_sub = csi->csiparse.sub;
+
+    *nbytep = csi_len;
     return TERMKEY_RES_KEY;
   }
 
@@ -652,7 +1158,10 @@ static TermKeyResult peekkey_ss3(TermKey *tk, TermKeyCsi *csi, size_t introlen,
 
 static TermKeyResult peekkey_ctrlstring(TermKey *tk, TermKeyCsi *csi, size_t introlen, TermKeyKey *key, int force, size_t *nbytep)
 {
-  size_t str_end = introlen;
+  if(!resume_scan(tk, csi, introlen))
+    csi->strscan = introlen;
+
+  size_t str_end = csi->strscan;
 
   while(str_end < tk->buffcount) {
     if(CHARAT(str_end) == 0x07) // BEL
@@ -667,13 +1176,15 @@ static TermKeyResult peekkey_ctrlstring(TermKey *tk, TermKeyCsi *csi, size_t int
     str_end++;
   }
 
-  if(str_end >= tk->buffcount)
+  if(str_end >= tk->buffcount) {
+    // Look at a trailing ESC again in case it starts an ST
+    csi->strscan = str_end;
+    if(str_end > introlen && CHARAT(str_end-1) == 0x1b)
+      csi->strscan--;
     return TERMKEY_RES_AGAIN;
+  }
 
-#ifdef DEBUG
-  fprintf(stderr, "Found a control string: %*s",
-      str_end - introlen, tk->buffer + tk->buffstart + introlen);
-#endif
+  csi->strscan = str_end;
 
   *nbytep = str_end + 1;
   if(CHARAT(str_end) == 0x1b)
@@ -687,9 +1198,13 @@ static TermKeyResult peekkey_ctrlstring(TermKey *tk, TermKeyCsi *csi, size_t int
   csi->saved_string_id++;
   csi->saved_string = malloc(len + 1);
 
-  strncpy(csi->saved_string, (char *)tk->buffer + tk->buffstart + introlen, len);
+  termkey_buffer_copy(tk, introlen, len, (unsigned char *)csi->saved_string);
   csi->saved_string[len] = 0;
 
+#ifdef DEBUG
+  fprintf(stderr, "Found a control string: %s", csi->saved_string);
+#endif
+
   key->type = (CHARAT(introlen-1) & 0x1f) == 0x10 ?
     TERMKEY_TYPE_DCS : TERMKEY_TYPE_OSC;
   key->code.number = csi->saved_string_id;
@@ -698,13 +1213,45 @@ static TermKeyResult peekkey_ctrlstring(TermKey *tk, TermKeyCsi *csi, size_t int
   return TERMKEY_RES_KEY;
 }
 
+/* Decodes the rest of a paste that continues at the head of the buffer */
+static TermKeyResult peekkey_pending(TermKey *tk, void *info, TermKeyKey *key, int force, size_t *nbytep)
+{
+  TermKeyCsi *csi = info;
+
+  /* Drivers aren't told when bytes are eaten, so a peeked paste event is only
+   * known to have been taken once a peek starts from where it ended */
+  if(csi->peeked_paste && csi->peeked_paste_resume == tk->buffpos) {
+    csi->in_paste = csi->peeked_paste_more;
+    csi->paste_resume = csi->peeked_paste_resume;
+    csi->paste_end = csi->peeked_paste_end;
+    csi->peeked_paste = 0;
+  }
+
+  // Until then, any byte may continue the paste
+  tk->driver_pending = csi->peeked_paste || csi->in_paste;
+
+  if(tk->buffcount == 0 || !csi->in_paste || csi->paste_resume != tk->buffpos)
+    return TERMKEY_RES_NONE;
+
+  if(tk->flags & TERMKEY_FLAG_STREAMPASTE)
+    return peekkey_paste_stream(tk, csi, csi->paste_end, key, force, nbytep);
+
+  if(!resume_scan(tk, csi, 0))
+    csi->strscan = 0;
+  return peekkey_paste(tk, csi, 0, csi->paste_end, key, force, nbytep);
+}
+
 static TermKeyResult peekkey(TermKey *tk, void *info, TermKeyKey *key, int force, size_t *nbytep)
 {
+  TermKeyCsi *csi = info;
+
+  TermKeyResult ret = peekkey_pending(tk, csi, key, force, nbytep);
+  if(ret != TERMKEY_RES_NONE)
+    return ret;
+
   if(tk->buffcount == 0)
     return tk->is_closed ? TERMKEY_RES_EOF : TERMKEY_RES_NONE;
 
-  TermKeyCsi *csi = info;
-
   switch(CHARAT(0)) {
     case 0x1b:
       if(tk->buffcount < 2)
@@ -738,15 +1285,157 @@ static TermKeyResult peekkey(TermKey *tk, void *info, TermKeyKey *key, int force
   return TERMKEY_RES_NONE;
 }
 
+static int may_start(TermKey *tk, void *info, unsigned char byte)
+{
+  switch(byte) {
+    case 0x1b: // ESC
+    case 0x8f: // SS3
+    case 0x90: // DCS
+    case 0x9b: // CSI
+    case 0x9d: // OSC
+      return 1;
+  }
+
+  return 0;
+}
+
+void termkey_csi_foreach_key(void (*fn)(const char *seq, const struct keyinfo *info, void *data), void *data)
+{
+  if(!keyinfo_initialised)
+    if(!register_keys())
+      return;
+
+  char seq[8];
+
+  for(int i = 0; i < 64; i++) {
+    unsigned char cmd = 0x40 + i;
+
+    if(csi_ss3s[i].sym != TERMKEY_SYM_UNKNOWN) {
+      if(csi_handlers[i] == &handle_csi_ss3_full) {
+        sprintf(seq, "\x1b[%c", cmd);
+        (*fn)(seq, &csi_ss3s[i], data);
+      }
+
+      sprintf(seq, "\x1bO%c", cmd);
+      (*fn)(seq, &csi_ss3s[i], data);
+    }
+    // Keypad keys with an alternate depend on TERMKEY_FLAG_CONVERTKP
+    else if(ss3s[i].sym != TERMKEY_SYM_UNKNOWN && !ss3_kpalts[i]) {
+      sprintf(seq, "\x1bO%c", cmd);
+      (*fn)(seq, &ss3s[i], data);
+    }
+  }
+
+  for(int n = 0; n < NCSIFUNCS; n++) {
+    if(csifuncs[n].sym == TERMKEY_SYM_UNKNOWN)
+      continue;
+
+    sprintf(seq, "\x1b[%d~", n);
+    (*fn)(seq, &csifuncs[n], data);
+  }
+}
+
+static int write_string(TermKey *tk, const char *str)
+{
+  struct stat statbuf;
+  size_t len;
+
+  if(tk->fd == -1)
+    return 1;
+
+  /* There's no point trying to write() to a pipe */
+  if(fstat(tk->fd, &statbuf) == -1)
+    return 0;
+
+#ifndef _WIN32
+  if(S_ISFIFO(statbuf.st_mode))
+    return 1;
+#endif
+
+  len = strlen(str);
+  while(len) {
+    size_t written = write(tk->fd, str, len);
+    if(written == -1)
+      return 0;
+    str += written;
+    len -= written;
+  }
+  return 1;
+}
+
+/* The kitty keyboard protocol keeps a stack of enhancement flags; ours are
+ * pushed on start and popped again on stop, leaving any beneath alone
+ */
+static int push_kittyflags(TermKey *tk, TermKeyCsi *csi)
+{
+  char str[16];
+
+  if(!tk->kittyflags)
+    return 1;
+
+  sprintf(str, "\x1b[>%du", tk->kittyflags);
+  if(!write_string(tk, str))
+    return 0;
+
+  csi->kitty_pushed = 1;
+  return 1;
+}
+
+static int pop_kittyflags(TermKey *tk, TermKeyCsi *csi)
+{
+  if(!csi->kitty_pushed)
+    return 1;
+
+  csi->kitty_pushed = 0;
+  return write_string(tk, "\x1b[<u");
+}
+
+static int start_driver(TermKey *tk, void *info)
+{
+  return push_kittyflags(tk, info);
+}
+
+static int stop_driver(TermKey *tk, void *info)
+{
+  return pop_kittyflags(tk, info);
+}
+
 struct TermKeyDriver termkey_driver_csi = {
   .name        = "CSI",
 
   .new_driver  = new_driver,
   .free_driver = free_driver,
 
-  .peekkey = peekkey,
+  .start_driver = start_driver,
+  .stop_driver  = stop_driver,
+
+  .peekkey   = peekkey,
+  .may_start = may_start,
+
+  .peekkey_pending = peekkey_pending,
 };
 
+int termkey_get_kittyflags(TermKey *tk)
+{
+  return tk->kittyflags;
+}
+
+void termkey_set_kittyflags(TermKey *tk, int flags)
+{
+  struct TermKeyDriverNode *p;
+  for(p = tk->drivers; p; p = p->next)
+    if(p->driver == &termkey_driver_csi)
+      break;
+
+  tk->kittyflags = flags;
+
+  if(!p || !tk->is_started)
+    return;
+
+  pop_kittyflags(tk, p->info);
+  push_kittyflags(tk, p->info);
+}
+
 TermKeyResult termkey_interpret_string(TermKey *tk, const TermKeyKey *key, const char **strp)
 {
   struct TermKeyDriverNode *p;
@@ -770,3 +1459,28 @@ TermKeyResult termkey_interpret_string(TermKey *tk, const TermKeyKey *key, const
 
   return TERMKEY_RES_KEY;
 }
+
+TermKeyResult termkey_interpret_paste(TermKey *tk, const TermKeyKey *key, const char **strp, size_t *lenp)
+{
+  struct TermKeyDriverNode *p;
+  for(p = tk->drivers; p; p = p->next)
+    if(p->driver == &termkey_driver_csi)
+      break;
+
+  if(!p)
+    return TERMKEY_RES_NONE;
+
+  if(key->type != TERMKEY_TYPE_PASTE &&
+     key->type != TERMKEY_TYPE_PASTE_DATA)
+    return TERMKEY_RES_NONE;
+
+  TermKeyCsi *csi = p->info;
+
+  if(csi->paste_id != key->code.number)
+    return TERMKEY_RES_NONE;
+
+  *strp = csi->paste;
+  *lenp = csi->paste_len;
+
+  return csi->paste_more ? TERMKEY_RES_AGAIN : TERMKEY_RES_KEY;
+}
@@ -4,20 +4,12 @@
 #include "termkey.h"
 #include "termkey-internal.h"
 
-#ifdef HAVE_UNIBILIUM
-# include <unibilium.h>
-#else
-# include <curses.h>
-# include <term.h>
-
-/* curses.h has just polluted our namespace. We want this back */
-# undef buttons
-#endif
-
 #include <ctype.h>
-#include <errno.h>
+#include <limits.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #ifndef _WIN32
 # include <unistd.h>
@@ -25,240 +17,564 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 
-#define streq(a,b) (!strcmp(a,b))
+#ifndef _WIN32
+# include <fcntl.h>
+# include <pthread.h>
+# include <sys/mman.h>
+#endif
 
-#define MAX_FUNCNAME 9
+#ifndef PATH_MAX
+# define PATH_MAX 4096
+#endif
 
-static struct {
-  const char *funcname;
+#define streq(a,b) (!strcmp(a,b))
+
+/* The key string capabilities, and their shifted versions. The names are
+ * those given to the getstr hook; the indexes are their place among the
+ * string capabilities of a compiled terminfo entry, or -1 if there isn't one
+ */
+static const struct {
+  const char *name, *sname;
+  short index, sindex;
   TermKeyType type;
   TermKeySym sym;
   int mods;
 } funcs[] =
 {
   /* THIS LIST MUST REMAIN SORTED! */
-  { "backspace", TERMKEY_TYPE_KEYSYM, TERMKEY_SYM_BACKSPACE, 0 },
-  { "begin",     TERMKEY_TYPE_KEYSYM, TERMKEY_SYM_BEGIN,     0 },
-  { "beg",       TERMKEY_TYPE_KEYSYM, TERMKEY_SYM_BEGIN,     0 },
-  { "btab",      TERMKEY_TYPE_KEYSYM, TERMKEY_SYM_TAB,       TERMKEY_KEYMOD_SHIFT },
-  { "cancel",    TERMKEY_TYPE_KEYSYM, TERMKEY_SYM_CANCEL,    0 },
-  { "clear",     TERMKEY_TYPE_KEYSYM, TERMKEY_SYM_CLEAR,     0 },
-  { "close",     TERMKEY_TYPE_KEYSYM, TERMKEY_SYM_CLOSE,     0 },
-  { "command",   TERMKEY_TYPE_KEYSYM, TERMKEY_SYM_COMMAND,   0 },
-  { "copy",      TERMKEY_TYPE_KEYSYM, TERMKEY_SYM_COPY,      0 },
-  { "dc",        TERMKEY_TYPE_KEYSYM, TERMKEY_SYM_DELETE,    0 },
-  { "down",      TERMKEY_TYPE_KEYSYM, TERMKEY_SYM_DOWN,      0 },
-  { "end",       TERMKEY_TYPE_KEYSYM, TERMKEY_SYM_END,       0 },
-  { "enter",     TERMKEY_TYPE_KEYSYM, TERMKEY_SYM_ENTER,     0 },
-  { "exit",      TERMKEY_TYPE_KEYSYM, TERMKEY_SYM_EXIT,      0 },
-  { "find",      TERMKEY_TYPE_KEYSYM, TERMKEY_SYM_FIND,      0 },
-  { "help",      TERMKEY_TYPE_KEYSYM, TERMKEY_SYM_HELP,      0 },
-  { "home",      TERMKEY_TYPE_KEYSYM, TERMKEY_SYM_HOME,      0 },
-  { "ic",        TERMKEY_TYPE_KEYSYM, TERMKEY_SYM_INSERT,    0 },
-  { "left",      TERMKEY_TYPE_KEYSYM, TERMKEY_SYM_LEFT,      0 },
-  { "mark",      TERMKEY_TYPE_KEYSYM, TERMKEY_SYM_MARK,      0 },
-  { "message",   TERMKEY_TYPE_KEYSYM, TERMKEY_SYM_MESSAGE,   0 },
-  { "move",      TERMKEY_TYPE_KEYSYM, TERMKEY_SYM_MOVE,      0 },
-  { "next",      TERMKEY_TYPE_KEYSYM, TERMKEY_SYM_PAGEDOWN,  0 }, // Not quite, but it's the best we can do
-  { "npage",     TERMKEY_TYPE_KEYSYM, TERMKEY_SYM_PAGEDOWN,  0 },
-  { "open",      TERMKEY_TYPE_KEYSYM, TERMKEY_SYM_OPEN,      0 },
-  { "options",   TERMKEY_TYPE_KEYSYM, TERMKEY_SYM_OPTIONS,   0 },
-  { "ppage",     TERMKEY_TYPE_KEYSYM, TERMKEY_SYM_PAGEUP,    0 },
-  { "previous",  TERMKEY_TYPE_KEYSYM, TERMKEY_SYM_PAGEUP,    0 }, // Not quite, but it's the best we can do
-  { "print",     TERMKEY_TYPE_KEYSYM, TERMKEY_SYM_PRINT,     0 },
-  { "redo",      TERMKEY_TYPE_KEYSYM, TERMKEY_SYM_REDO,      0 },
-  { "reference", TERMKEY_TYPE_KEYSYM, TERMKEY_SYM_REFERENCE, 0 },
-  { "refresh",   TERMKEY_TYPE_KEYSYM, TERMKEY_SYM_REFRESH,   0 },
-  { "replace",   TERMKEY_TYPE_KEYSYM, TERMKEY_SYM_REPLACE,   0 },
-  { "restart",   TERMKEY_TYPE_KEYSYM, TERMKEY_SYM_RESTART,   0 },
-  { "resume",    TERMKEY_TYPE_KEYSYM, TERMKEY_SYM_RESUME,    0 },
-  { "right",     TERMKEY_TYPE_KEYSYM, TERMKEY_SYM_RIGHT,     0 },
-  { "save",      TERMKEY_TYPE_KEYSYM, TERMKEY_SYM_SAVE,      0 },
-  { "select",    TERMKEY_TYPE_KEYSYM, TERMKEY_SYM_SELECT,    0 },
-  { "suspend",   TERMKEY_TYPE_KEYSYM, TERMKEY_SYM_SUSPEND,   0 },
-  { "undo",      TERMKEY_TYPE_KEYSYM, TERMKEY_SYM_UNDO,      0 },
-  { "up",        TERMKEY_TYPE_KEYSYM, TERMKEY_SYM_UP,        0 },
+  { "key_backspace", "key_sbackspace",  55,  -1, TERMKEY_TYPE_KEYSYM, TERMKEY_SYM_BACKSPACE,    0 },
+  { "key_begin",     "key_sbegin",      -1,  -1, TERMKEY_TYPE_KEYSYM, TERMKEY_SYM_BEGIN,        0 },
+  { "key_beg",       "key_sbeg",       158, 186, TERMKEY_TYPE_KEYSYM, TERMKEY_SYM_BEGIN,        0 },
+  { "key_btab",      "key_sbtab",      148,  -1, TERMKEY_TYPE_KEYSYM, TERMKEY_SYM_TAB,          TERMKEY_KEYMOD_SHIFT },
+  { "key_cancel",    "key_scancel",    159, 187, TERMKEY_TYPE_KEYSYM, TERMKEY_SYM_CANCEL,       0 },
+  { "key_clear",     "key_sclear",      57,  -1, TERMKEY_TYPE_KEYSYM, TERMKEY_SYM_CLEAR,        0 },
+  { "key_close",     "key_sclose",     160,  -1, TERMKEY_TYPE_KEYSYM, TERMKEY_SYM_CLOSE,        0 },
+  { "key_command",   "key_scommand",   161, 188, TERMKEY_TYPE_KEYSYM, TERMKEY_SYM_COMMAND,      0 },
+  { "key_copy",      "key_scopy",      162, 189, TERMKEY_TYPE_KEYSYM, TERMKEY_SYM_COPY,         0 },
+  { "key_dc",        "key_sdc",         59, 191, TERMKEY_TYPE_KEYSYM, TERMKEY_SYM_DELETE,       0 },
+  { "key_down",      "key_sdown",       61,  -1, TERMKEY_TYPE_KEYSYM, TERMKEY_SYM_DOWN,         0 },
+  { "key_end",       "key_send",       164, 194, TERMKEY_TYPE_KEYSYM, TERMKEY_SYM_END,          0 },
+  { "key_enter",     "key_senter",     165,  -1, TERMKEY_TYPE_KEYSYM, TERMKEY_SYM_ENTER,        0 },
+  { "key_exit",      "key_sexit",      166, 196, TERMKEY_TYPE_KEYSYM, TERMKEY_SYM_EXIT,         0 },
+  { "key_find",      "key_sfind",      167, 197, TERMKEY_TYPE_KEYSYM, TERMKEY_SYM_FIND,         0 },
+  { "key_help",      "key_shelp",      168, 198, TERMKEY_TYPE_KEYSYM, TERMKEY_SYM_HELP,         0 },
+  { "key_home",      "key_shome",       76, 199, TERMKEY_TYPE_KEYSYM, TERMKEY_SYM_HOME,         0 },
+  { "key_ic",        "key_sic",         77, 200, TERMKEY_TYPE_KEYSYM, TERMKEY_SYM_INSERT,       0 },
+  { "key_left",      "key_sleft",       79, 201, TERMKEY_TYPE_KEYSYM, TERMKEY_SYM_LEFT,         0 },
+  { "key_mark",      "key_smark",      169,  -1, TERMKEY_TYPE_KEYSYM, TERMKEY_SYM_MARK,         0 },
+  { "key_message",   "key_smessage",   170, 202, TERMKEY_TYPE_KEYSYM, TERMKEY_SYM_MESSAGE,      0 },
+  { "key_move",      "key_smove",      171, 203, TERMKEY_TYPE_KEYSYM, TERMKEY_SYM_MOVE,         0 },
+  { "key_next",      "key_snext",      172, 204, TERMKEY_TYPE_KEYSYM, TERMKEY_SYM_PAGEDOWN,     0 }, // Not quite, but it's the best we can do
+  { "key_npage",     "key_snpage",      81,  -1, TERMKEY_TYPE_KEYSYM, TERMKEY_SYM_PAGEDOWN,     0 },
+  { "key_open",      "key_sopen",      173,  -1, TERMKEY_TYPE_KEYSYM, TERMKEY_SYM_OPEN,         0 },
+  { "key_options",   "key_soptions",   174, 205, TERMKEY_TYPE_KEYSYM, TERMKEY_SYM_OPTIONS,      0 },
+  { "key_ppage",     "key_sppage",      82,  -1, TERMKEY_TYPE_KEYSYM, TERMKEY_SYM_PAGEUP,       0 },
+  { "key_previous",  "key_sprevious",  175, 206, TERMKEY_TYPE_KEYSYM, TERMKEY_SYM_PAGEUP,       0 }, // Not quite, but it's the best we can do
+  { "key_print",     "key_sprint",     176, 207, TERMKEY_TYPE_KEYSYM, TERMKEY_SYM_PRINT,        0 },
+  { "key_redo",      "key_sredo",      177, 208, TERMKEY_TYPE_KEYSYM, TERMKEY_SYM_REDO,         0 },
+  { "key_reference", "key_sreference", 178,  -1, TERMKEY_TYPE_KEYSYM, TERMKEY_SYM_REFERENCE,    0 },
+  { "key_refresh",   "key_srefresh",   179,  -1, TERMKEY_TYPE_KEYSYM, TERMKEY_SYM_REFRESH,      0 },
+  { "key_replace",   "key_sreplace",   180, 209, TERMKEY_TYPE_KEYSYM, TERMKEY_SYM_REPLACE,      0 },
+  { "key_restart",   "key_srestart",   181,  -1, TERMKEY_TYPE_KEYSYM, TERMKEY_SYM_RESTART,      0 },
+  { "key_resume",    "key_sresume",    182,  -1, TERMKEY_TYPE_KEYSYM, TERMKEY_SYM_RESUME,       0 },
+  { "key_right",     "key_sright",      83, 210, TERMKEY_TYPE_KEYSYM, TERMKEY_SYM_RIGHT,        0 },
+  { "key_save",      "key_ssave",      183, 212, TERMKEY_TYPE_KEYSYM, TERMKEY_SYM_SAVE,         0 },
+  { "key_select",    "key_sselect",    193,  -1, TERMKEY_TYPE_KEYSYM, TERMKEY_SYM_SELECT,       0 },
+  { "key_suspend",   "key_ssuspend",   184, 213, TERMKEY_TYPE_KEYSYM, TERMKEY_SYM_SUSPEND,      0 },
+  { "key_undo",      "key_sundo",      185, 214, TERMKEY_TYPE_KEYSYM, TERMKEY_SYM_UNDO,         0 },
+  { "key_up",        "key_sup",         87,  -1, TERMKEY_TYPE_KEYSYM, TERMKEY_SYM_UP,           0 },
   { NULL },
 };
 
-#ifdef HAVE_UNIBILIUM
-static enum unibi_string unibi_lookup_str(const char *name)
-{
-  for(enum unibi_string ret = unibi_string_begin_+1; ret < unibi_string_end_; ret++)
-    if(streq(unibi_name_str(ret), name))
-      return ret;
+/* The terminfo database is read directly, rather than through curses or
+ * unibilium. Only the string capabilities of the standard section are ever
+ * needed, so that is all that gets looked at. The compiled format stores
+ * these in a fixed order; the indexes of the key ones are in funcs[] above,
+ * and of the rest here.
+ */
+#define TI_KEY_MOUSE     355
+#define TI_KEYPAD_LOCAL   88
+#define TI_KEYPAD_XMIT    89
 
+/* Returns the index of key_f<n>, or -1 if terminfo has no such capability */
+static int ti_fkey_index(int n)
+{
+  // key_f10 is sorted in among the first ten
+  if(n <= 1)
+    return 65 + n;
+  if(n == 10)
+    return 67;
+  if(n < 10)
+    return 66 + n;
+  if(n <= 63)
+    return 205 + n;
   return -1;
 }
 
-static const char *unibi_get_str_by_name(const unibi_term *ut, const char *name)
+/* A compiled terminfo entry. The header is six little-endian 16-bit counts:
+ * the magic number, the size of the names, then the number of booleans,
+ * numbers and strings, and the size of the string table. The names and
+ * booleans follow, padded to an even offset, then the numbers, which are 16
+ * bits in the legacy format and 32 bits in the extended-number one, then the
+ * string offsets and the string table. Anything after that is ncurses'
+ * extended capabilities, which aren't looked at.
+ */
+#define TERMINFO_MAGIC       0432
+#define TERMINFO_MAGIC_NUM32 01036
+
+#define TERMINFO_MAXSIZE     (1 << 20)
+
+struct terminfo {
+  unsigned char *data;
+  const unsigned char *stroffs;
+  int nstrings;
+  const char *strtab;
+  size_t strtabsize;
+};
+
+static int ti_le16(const unsigned char *p)
+{
+  return p[0] | (p[1] << 8);
+}
+
+static bool stat_terminfo_in(const char *dir, const char *term, char *path, size_t size, struct stat *st)
+{
+  if(!dir || !dir[0])
+    return false;
+
+  if(snprintf(path, size, "%s/%c/%s", dir, term[0], term) < size &&
+     stat(path, st) == 0)
+    return true;
+
+  // Some systems use the hex value of the first letter instead
+  if(snprintf(path, size, "%s/%02x/%s", dir, (unsigned char)term[0], term) < size &&
+     stat(path, st) == 0)
+    return true;
+
+  return false;
+}
+
+/* Finds the terminfo file for term in the directories curses searches, in the
+ * same order, leaving its name in path
+ */
+static bool find_terminfo(const char *term, char *path, size_t size, struct stat *st)
+{
+  static const char *const sysdirs[] = {
+    "/etc/terminfo", "/lib/terminfo", "/usr/share/terminfo", "/usr/lib/terminfo", NULL
+  };
+  const char *env;
+  char dir[PATH_MAX];
+
+  // Not a name that could escape the directory
+  if(!term || !term[0] || term[0] == '.' || strchr(term, '/'))
+    return false;
+
+  if(stat_terminfo_in(getenv("TERMINFO"), term, path, size, st))
+    return true;
+
+  if((env = getenv("HOME")) && snprintf(dir, sizeof dir, "%s/.terminfo", env) < sizeof dir &&
+     stat_terminfo_in(dir, term, path, size, st))
+    return true;
+
+  if((env = getenv("TERMINFO_DIRS"))) {
+    for(;;) {
+      size_t len = strcspn(env, ":");
+      // An empty entry stands for the system directories
+      if(!len) {
+        for(int i = 0; sysdirs[i]; i++)
+          if(stat_terminfo_in(sysdirs[i], term, path, size, st))
+            return true;
+      }
+      else if(len < sizeof dir) {
+        memcpy(dir, env, len);
+        dir[len] = 0;
+        if(stat_terminfo_in(dir, term, path, size, st))
+          return true;
+      }
+      env += len;
+      if(!*env)
+        break;
+      env++;
+    }
+  }
+
+  for(int i = 0; sysdirs[i]; i++)
+    if(stat_terminfo_in(sysdirs[i], term, path, size, st))
+      return true;
+
+  return false;
+}
+
+/* Reads the compiled terminfo entry for term. Returns NULL if there isn't one
+ * or it isn't valid
+ */
+static struct terminfo *read_terminfo(const char *term)
 {
-  enum unibi_string idx = unibi_lookup_str(name);
-  if(idx == (enum unibi_string)-1)
+  char path[PATH_MAX];
+  struct stat st;
+  struct terminfo *tinfo = NULL;
+  unsigned char *data = NULL;
+  FILE *f;
+
+  if(!find_terminfo(term, path, sizeof path, &st) ||
+     !S_ISREG(st.st_mode) || st.st_size < 12 || st.st_size > TERMINFO_MAXSIZE)
+    return NULL;
+
+  if(!(f = fopen(path, "rb")))
     return NULL;
 
-  return unibi_get_str(ut, idx);
+  size_t len = st.st_size;
+  if(!(data = malloc(len)) || fread(data, 1, len, f) != len)
+    goto fail;
+
+  int magic      = ti_le16(data);
+  int namessize  = ti_le16(data + 2);
+  int nbools     = ti_le16(data + 4);
+  int nnums      = ti_le16(data + 6);
+  int nstrings   = ti_le16(data + 8);
+  int strtabsize = ti_le16(data + 10);
+
+  if((magic != TERMINFO_MAGIC && magic != TERMINFO_MAGIC_NUM32) ||
+     namessize >= 0x8000 || nbools >= 0x8000 || nnums >= 0x8000 ||
+     nstrings >= 0x8000 || strtabsize >= 0x8000)
+    goto fail;
+
+  size_t off = 12 + namessize + nbools;
+  off += off & 1;
+  off += nnums * (magic == TERMINFO_MAGIC_NUM32 ? 4 : 2);
+  off += nstrings * 2;
+
+  if(off + strtabsize > len || !(tinfo = malloc(sizeof *tinfo)))
+    goto fail;
+
+  tinfo->data       = data;
+  tinfo->stroffs    = data + off - nstrings * 2;
+  tinfo->nstrings   = nstrings;
+  tinfo->strtab     = (const char *)data + off;
+  tinfo->strtabsize = strtabsize;
+
+  fclose(f);
+  return tinfo;
+
+fail:
+  free(data);
+  fclose(f);
+  return NULL;
+}
+
+static void free_terminfo(struct terminfo *tinfo)
+{
+  if(!tinfo)
+    return;
+
+  free(tinfo->data);
+  free(tinfo);
+}
+
+/* Returns the string capability at index, or NULL if it is absent, cancelled
+ * or doesn't fit in the string table
+ */
+static const char *terminfo_get_str(const struct terminfo *tinfo, int index)
+{
+  if(!tinfo || index < 0 || index >= tinfo->nstrings)
+    return NULL;
+
+  // Absent (-1) and cancelled (-2) strings are out of range too
+  size_t off = ti_le16(tinfo->stroffs + index * 2);
+  if(off >= tinfo->strtabsize ||
+     !memchr(tinfo->strtab + off, 0, tinfo->strtabsize - off))
+    return NULL;
+
+  return tinfo->strtab + off;
 }
-#endif
 
 /* To be efficient at lookups, we store the byte sequence => keyinfo mapping
  * in a trie. This avoids a slow linear search through a flat list of
- * sequences. Because it is likely most nodes will be very sparse, we optimise
- * vector to store an extent map after the database is loaded.
+ * sequences. Because it is likely most nodes will be very sparse, each node
+ * only stores the extent of bytes it has children for.
+ *
+ * The trie is a single array of 32-bit cells so a walk touches only a few
+ * cache lines. Each node starts with a header cell holding the min and max of
+ * its extent, and TRIE_KEY if it is a key. An extent node is followed by one
+ * cell per byte in its extent, giving the cell offset of that child or 0 for
+ * none; the root is at offset 0 so is never a child. A key node is followed
+ * by its keyinfo fields.
+ *
+ * While loading, the keys are only collected. They are then sorted, so each
+ * node's children form one contiguous run, and the trie is written out in a
+ * single pass with no intermediate nodes.
  */
 
-typedef enum {
-  TYPE_KEY,
-  TYPE_ARR,
-} trie_nodetype;
+#define TRIE_KEY        (1 << 16)
+#define TRIE_KEYCELLS   4
 
-struct trie_node {
-  trie_nodetype type;
-};
-
-struct trie_node_key {
-  trie_nodetype type;
+struct trie_entry {
+  char *seq;
+  size_t len;
+  unsigned int order;   /* Earlier keys win conflicts */
   struct keyinfo key;
 };
 
-struct trie_node_arr {
-  trie_nodetype type;
-  unsigned char min, max; /* INCLUSIVE endpoints of the extent range */
-  struct trie_node *arr[]; /* dynamic size at allocation time */
+/* The loaded trie and strings for one terminal type never change, so all the
+ * instances for the same type, getstr hook and loading flags share one copy.
+ * These are kept on a process-wide list while any instance uses them
+ */
+struct ti_shared {
+  struct ti_shared *next;
+  unsigned int refcount;
+
+  char *termname;   /* NULL if not on the list */
+  char found;       /* The terminal was in the database */
+  TermKey_Terminfo_Getstr_Hook *hook;
+  void *hook_data;
+  int flags;
+
+  uint32_t *trie;
+  size_t    ntrie;  /* in cells */
+
+  char *start_string;
+  char *stop_string;
+
+  void  *map;       /* The above point into this mapped cache file */
+  size_t maplen;
+
+  char builtin;     /* A static table; see below */
 };
 
-typedef struct {
-  TermKey *tk;
+/* Flags that change what is loaded */
+#define SHARED_FLAGS TERMKEY_FLAG_MERGEKEYS
 
-#ifdef HAVE_UNIBILIUM
-  unibi_term *unibi;  /* only valid until first 'start' call */
+/* Keys for common terminals, generated when the library is built by running
+ * mkbuiltin on the build machine's terminfo. Each is a static ti_shared
+ * record, used when no flags, hook or terminfo of the user's own change what
+ * would be loaded, and never freed
+ */
+#ifndef TERMKEY_MKBUILTIN
+# include "termkey-builtin.inc"
 #else
-  char *term; /* only valid until first 'start' call */
+static struct ti_shared *const builtin_ti[] = { NULL };
 #endif
 
-  struct trie_node *root;
+static struct ti_shared *find_builtin(const char *term)
+{
+  if(!term)
+    return NULL;
 
-  char *start_string;
-  char *stop_string;
-} TermKeyTI;
+  for(int i = 0; builtin_ti[i]; i++)
+    if(streq(builtin_ti[i]->termname, term))
+      return builtin_ti[i];
 
-static int insert_seq(TermKeyTI *ti, const char *seq, struct trie_node *node);
+  return NULL;
+}
 
-static struct trie_node *new_node_key(TermKeyType type, TermKeySym sym, int modmask, int modset)
+/* Whether curses would find a terminfo entry for term that the user chose,
+ * ahead of the system one the builtin keys were made from
+ */
+static bool has_user_terminfo(const char *term)
 {
-  struct trie_node_key *n = malloc(sizeof(*n));
-  if(!n)
-    return NULL;
+  const char *home;
+  char dir[PATH_MAX], path[PATH_MAX];
+  struct stat st;
+
+  if(getenv("TERMINFO") || getenv("TERMINFO_DIRS"))
+    return true;
 
-  n->type = TYPE_KEY;
+  return (home = getenv("HOME")) && snprintf(dir, sizeof dir, "%s/.terminfo", home) < sizeof dir &&
+    stat_terminfo_in(dir, term, path, sizeof path, &st);
+}
 
-  n->key.type = type;
-  n->key.sym  = sym;
-  n->key.modifier_mask = modmask;
-  n->key.modifier_set  = modset;
+typedef struct {
+  TermKey *tk;
 
-  return (struct trie_node*)n;
+  char *termname;
+
+  /* only valid while loading */
+  struct terminfo *tinfo;
+  struct trie_entry *entries;
+  size_t nentries, entriessize;
+
+  struct ti_shared *shared;
+  const uint32_t *trie;     /* shared->trie */
+} TermKeyTI;
+
+static bool add_key(TermKeyTI *ti, const char *seq, const struct keyinfo *info)
+{
+  if(ti->nentries == ti->entriessize) {
+    size_t newsize = ti->entriessize ? ti->entriessize * 2 : 64;
+    struct trie_entry *newentries = realloc(ti->entries, newsize * sizeof(newentries[0]));
+    if(!newentries)
+      return false;
+
+    ti->entries = newentries;
+    ti->entriessize = newsize;
+  }
+
+  char *copy = strdup(seq);
+  if(!copy)
+    return false;
+
+  struct trie_entry *e = &ti->entries[ti->nentries];
+  e->seq = copy;
+  e->len = strlen(seq);
+  e->order = ti->nentries;
+  e->key = *info;
+
+  ti->nentries++;
+
+  return true;
 }
 
-static struct trie_node *new_node_arr(unsigned char min, unsigned char max)
+static void free_entries(TermKeyTI *ti)
 {
-  struct trie_node_arr *n = malloc(sizeof(*n) + ((int)max-min+1) * sizeof(n->arr[0]));
-  if(!n)
-    return NULL;
+  for(size_t i = 0; i < ti->nentries; i++)
+    free(ti->entries[i].seq);
 
-  n->type = TYPE_ARR;
-  n->min = min; n->max = max;
+  free(ti->entries);
 
-  int i;
-  for(i = min; i <= max; i++)
-    n->arr[i-min] = NULL;
+  ti->entries = NULL;
+  ti->nentries = ti->entriessize = 0;
+}
+
+static int cmp_entries(const void *a, const void *b)
+{
+  const struct trie_entry *ea = a, *eb = b;
+
+  size_t len = ea->len < eb->len ? ea->len : eb->len;
+  int cmp = memcmp(ea->seq, eb->seq, len);
+  if(cmp)
+    return cmp;
+
+  if(ea->len != eb->len)
+    return ea->len < eb->len ? -1 : 1;
 
-  return (struct trie_node*)n;
+  return ea->order < eb->order ? -1 : 1;
 }
 
-static struct trie_node *lookup_next(struct trie_node *n, unsigned char b)
+/* Sorts the entries, then drops any whose sequence conflicts with another's
+ * by being equal to it, a prefix of it or an extension of it, keeping the one
+ * added first. In sorted order a conflicting pair is always adjacent once the
+ * losers in between are gone
+ */
+static void sort_entries(TermKeyTI *ti)
 {
-  switch(n->type) {
-  case TYPE_KEY:
-    fprintf(stderr, "ABORT: lookup_next within a TYPE_KEY node\n");
-    abort();
-  case TYPE_ARR:
-    {
-      struct trie_node_arr *nar = (struct trie_node_arr*)n;
-      if(b < nar->min || b > nar->max)
-        return NULL;
-      return nar->arr[b - nar->min];
+  struct trie_entry *e = ti->entries;
+  size_t n = 0;
+
+  if(ti->nentries)
+    qsort(e, ti->nentries, sizeof(e[0]), &cmp_entries);
+
+  for(size_t i = 0; i < ti->nentries; i++) {
+    if(n && e[n-1].len <= e[i].len && memcmp(e[n-1].seq, e[i].seq, e[n-1].len) == 0) {
+      if(e[i].order < e[n-1].order) {
+        free(e[n-1].seq);
+        e[n-1] = e[i];
+      }
+      else
+        free(e[i].seq);
+      continue;
     }
+
+    e[n++] = e[i];
   }
 
-  return NULL; // Never reached but keeps compiler happy
+  ti->nentries = n;
 }
 
-static void free_trie(struct trie_node *n)
+/* Writes the node for the sorted, conflict-free entries [lo,hi) that share
+ * their first depth bytes, with its subtree after it from *nextp. With cells
+ * NULL it only counts. Returns the node's offset
+ */
+static uint32_t emit_node(const struct trie_entry *e, size_t lo, size_t hi, size_t depth, uint32_t *cells, uint32_t *nextp)
 {
-  switch(n->type) {
-  case TYPE_KEY:
-    break;
-  case TYPE_ARR:
-    {
-      struct trie_node_arr *nar = (struct trie_node_arr*)n;
-      int i;
-      for(i = nar->min; i <= nar->max; i++)
-        if(nar->arr[i - nar->min])
-          free_trie(nar->arr[i - nar->min]);
-      break;
+  uint32_t at = *nextp;
+
+  if(hi - lo == 1 && e[lo].len == depth) {
+    if(cells) {
+      cells[at] = TRIE_KEY;
+      cells[at+1] = e[lo].key.type;
+      cells[at+2] = e[lo].key.sym;
+      cells[at+3] = e[lo].key.modifier_mask;
+      cells[at+4] = e[lo].key.modifier_set;
     }
+    *nextp += 1 + TRIE_KEYCELLS;
+    return at;
+  }
+
+  if(lo == hi) {
+    // An empty extent; nothing is ever found in it
+    if(cells)
+      cells[at] = 1;
+    *nextp += 1;
+    return at;
+  }
+
+  unsigned char min = e[lo].seq[depth], max = e[hi-1].seq[depth];
+
+  if(cells) {
+    cells[at] = min | max << 8;
+    for(int b = min; b <= max; b++)
+      cells[at + 1 + b - min] = 0;
   }
+  *nextp += 1 + (max - min + 1);
 
-  free(n);
+  while(lo < hi) {
+    unsigned char b = e[lo].seq[depth];
+    size_t end = lo + 1;
+    while(end < hi && (unsigned char)e[end].seq[depth] == b)
+      end++;
+
+    uint32_t child = emit_node(e, lo, end, depth + 1, cells, nextp);
+    if(cells)
+      cells[at + 1 + b - min] = child;
+
+    lo = end;
+  }
+
+  return at;
 }
 
-static struct trie_node *compress_trie(struct trie_node *n)
+/* Builds ti->trie from the collected entries, which are then freed */
+static int build_trie(TermKeyTI *ti, struct ti_shared *sh)
 {
-  if(!n)
-    return NULL;
+  sort_entries(ti);
 
-  switch(n->type) {
-  case TYPE_KEY:
-    return n;
-  case TYPE_ARR:
-    {
-      struct trie_node_arr *nar = (struct trie_node_arr*)n;
-      unsigned char min, max;
-      // Find the real bounds
-      for(min = 0; !nar->arr[min]; min++)
-        if(min == 255 && !nar->arr[min]) {
-          free(nar);
-          return new_node_arr(1, 0);
-        }
-
-      for(max = 0xff; !nar->arr[max]; max--)
-        ;
-
-      struct trie_node_arr *new = (struct trie_node_arr*)new_node_arr(min, max);
-      int i;
-      for(i = min; i <= max; i++)
-        new->arr[i - min] = compress_trie(nar->arr[i]);
-
-      free(nar);
-      return (struct trie_node*)new;
-    }
+  uint32_t ncells = 0;
+  emit_node(ti->entries, 0, ti->nentries, 0, NULL, &ncells);
+
+  uint32_t *cells = malloc(ncells * sizeof(cells[0]));
+  if(!cells) {
+    free_entries(ti);
+    return 0;
   }
 
-  return n;
+  uint32_t next = 0;
+  emit_node(ti->entries, 0, ti->nentries, 0, cells, &next);
+
+  free_entries(ti);
+
+  sh->trie = cells;
+  sh->ntrie = ncells;
+
+  return 1;
 }
 
-static bool try_load_terminfo_key(TermKeyTI *ti, const char *name, struct keyinfo *info)
+/* Returns the cell offset of the child of the extent node at n for byte b, or
+ * 0 if there is none
+ */
+static inline uint32_t trie_next(const uint32_t *cells, uint32_t n, unsigned char b)
 {
-  const char *value = NULL;
+  uint32_t hdr = cells[n];
+  unsigned char min = hdr & 0xff, max = (hdr >> 8) & 0xff;
 
-#ifdef HAVE_UNIBILIUM
-  if(ti->unibi)
-    value = unibi_get_str_by_name(ti->unibi, name);
-#else
-  if(ti->term)
-    value = tigetstr(name);
-#endif
+  if(b < min || b > max)
+    return 0;
+
+  return cells[n + 1 + b - min];
+}
+
+static bool try_load_terminfo_key(TermKeyTI *ti, const char *name, int index, struct keyinfo *info)
+{
+  const char *value = terminfo_get_str(ti->tinfo, index);
 
   if(ti->tk->ti_getstr_hook)
     value = (ti->tk->ti_getstr_hook)(name, value, ti->tk->ti_getstr_hook_data);
@@ -266,40 +582,31 @@ static bool try_load_terminfo_key(TermKeyTI *ti, const char *name, struct keyinf
   if(!value || value == (char*)-1 || !value[0])
     return false;
 
-  struct trie_node *node = new_node_key(info->type, info->sym, info->modifier_mask, info->modifier_set);
-  insert_seq(ti, value, node);
+  return add_key(ti, value, info);
+}
 
-  return true;
+/* Adds a CSI driver key to the trie. These are added after all the terminfo
+ * keys, so terminfo wins where a sequence is the same as, a prefix of or an
+ * extension of one of those */
+static void merge_csi_key(const char *seq, const struct keyinfo *info, void *data)
+{
+  add_key(data, seq, info);
 }
 
-static int load_terminfo(TermKeyTI *ti)
+static int load_terminfo(TermKeyTI *ti, struct ti_shared *sh)
 {
   int i;
 
-#ifdef HAVE_UNIBILIUM
-  unibi_term *unibi = ti->unibi;
-#else
-  {
-    int err;
-
-    /* Have to cast away the const. But it's OK - we know terminfo won't really
-    * modify term */
-    if(setupterm((char*)ti->term, 1, &err) != OK)
-      return 0;
-  }
-#endif
-
-  ti->root = new_node_arr(0, 0xff);
-  if(!ti->root)
-    return 0;
+  /* tinfo may be NULL if the terminal wasn't known. Lets keep going because
+   * if we get getstr hook that might invent new strings for us
+   */
+  struct terminfo *tinfo = ti->tinfo = read_terminfo(ti->termname);
+  sh->found = tinfo != NULL;
 
   /* First the regular key strings
    */
-  for(i = 0; funcs[i].funcname; i++) {
-    char name[MAX_FUNCNAME + 5 + 1];
-
-    sprintf(name, "key_%s", funcs[i].funcname);
-    if(!try_load_terminfo_key(ti, name, &(struct keyinfo){
+  for(i = 0; funcs[i].name; i++) {
+    if(!try_load_terminfo_key(ti, funcs[i].name, funcs[i].index, &(struct keyinfo){
           .type = funcs[i].type,
           .sym  = funcs[i].sym,
           .modifier_mask = funcs[i].mods,
@@ -308,8 +615,7 @@ static int load_terminfo(TermKeyTI *ti)
       continue;
 
     /* Maybe it has a shifted version */
-    sprintf(name, "key_s%s", funcs[i].funcname);
-    try_load_terminfo_key(ti, name, &(struct keyinfo){
+    try_load_terminfo_key(ti, funcs[i].sname, funcs[i].sindex, &(struct keyinfo){
         .type = funcs[i].type,
         .sym  = funcs[i].sym,
         .modifier_mask = funcs[i].mods | TERMKEY_KEYMOD_SHIFT,
@@ -320,9 +626,16 @@ static int load_terminfo(TermKeyTI *ti)
   /* Now the F<digit> keys
    */
   for(i = 1; i < 255; i++) {
-    char name[9];
-    sprintf(name, "key_f%d", i);
-    if(!try_load_terminfo_key(ti, name, &(struct keyinfo){
+    int index = ti_fkey_index(i);
+    char name[9] = "";
+
+    /* Only the hook needs the name, and it may know keys past key_f63 */
+    if(ti->tk->ti_getstr_hook)
+      sprintf(name, "key_f%d", i);
+    else if(index < 0)
+      break;
+
+    if(!try_load_terminfo_key(ti, name, index, &(struct keyinfo){
           .type = TERMKEY_TYPE_FUNCTION,
           .sym  = i,
           .modifier_mask = 0,
@@ -333,15 +646,7 @@ static int load_terminfo(TermKeyTI *ti)
 
   /* Finally mouse mode */
   {
-    const char *value = NULL;
-
-#ifdef HAVE_UNIBILIUM
-    if(ti->unibi)
-      value = unibi_get_str_by_name(ti->unibi, "key_mouse");
-#else
-    if(ti->term)
-      value = tigetstr("key_mouse");
-#endif
+    const char *value = terminfo_get_str(tinfo, TI_KEY_MOUSE);
 
     if(ti->tk->ti_getstr_hook)
       value = (ti->tk->ti_getstr_hook)("key_mouse", value, ti->tk->ti_getstr_hook_data);
@@ -349,53 +654,404 @@ static int load_terminfo(TermKeyTI *ti)
     /* Some terminfos (e.g. xterm-1006) claim a different key_mouse that won't
      * give X10 encoding. We'll only accept this if it's exactly "\e[M"
      */
-    if(value && streq(value, "\x1b[M")) {
-      struct trie_node *node = new_node_key(TERMKEY_TYPE_MOUSE, 0, 0, 0);
-      insert_seq(ti, value, node);
-    }
+    if(value && value != (char*)-1 && streq(value, "\x1b[M"))
+      add_key(ti, value, &(struct keyinfo){
+          .type = TERMKEY_TYPE_MOUSE,
+      });
   }
 
   /* Take copies of these terminfo strings, in case we build multiple termkey
    * instances for multiple different termtypes, and it's different by the
    * time we want to use it
    */
-#ifdef HAVE_UNIBILIUM
-  const char *keypad_xmit = unibi ?
-    unibi_get_str(unibi, unibi_keypad_xmit) :
-    NULL;
-#endif
+  const char *keypad_xmit = terminfo_get_str(tinfo, TI_KEYPAD_XMIT);
 
   if(keypad_xmit)
-    ti->start_string = strdup(keypad_xmit);
+    sh->start_string = strdup(keypad_xmit);
   else
-    ti->start_string = NULL;
+    sh->start_string = NULL;
 
-#ifdef HAVE_UNIBILIUM
-  const char *keypad_local = unibi ?
-    unibi_get_str(unibi, unibi_keypad_local) :
-    NULL;
-#endif
+  const char *keypad_local = terminfo_get_str(tinfo, TI_KEYPAD_LOCAL);
 
   if(keypad_local)
-    ti->stop_string = strdup(keypad_local);
+    sh->stop_string = strdup(keypad_local);
   else
-    ti->stop_string = NULL;
+    sh->stop_string = NULL;
+
+  free_terminfo(tinfo);
+  ti->tinfo = NULL;
+
+  /* Then the CSI driver's fixed keys, so that each of those sequences takes
+   * a single walk of the trie
+   */
+  if(ti->tk->flags & TERMKEY_FLAG_MERGEKEYS)
+    termkey_csi_foreach_key(&merge_csi_key, ti);
 
-#ifdef HAVE_UNIBILIUM
-  if(unibi)
-    unibi_destroy(unibi);
+  return build_trie(ti, sh);
+}
 
-  ti->unibi = NULL;
+#ifndef _WIN32
+static pthread_mutex_t shared_lock = PTHREAD_MUTEX_INITIALIZER;
+# define LOCK_SHARED()   pthread_mutex_lock(&shared_lock)
+# define UNLOCK_SHARED() pthread_mutex_unlock(&shared_lock)
 #else
-  if(ti->term)
-    free(ti->term);
+# define LOCK_SHARED()
+# define UNLOCK_SHARED()
+#endif
+
+static struct ti_shared *shared_list;
+
+static void free_shared(struct ti_shared *sh)
+{
+#ifndef _WIN32
+  if(sh->map)
+    munmap(sh->map, sh->maplen);
+  else
+#endif
+  {
+    free(sh->trie);
+    free(sh->start_string);
+    free(sh->stop_string);
+  }
+  free(sh->termname);
+  free(sh);
+}
+
+#ifndef _WIN32
+/* With TERMKEY_FLAG_DISKCACHE, the loaded keys for a terminal are also written
+ * to a file in the user's cache directory, which later processes map in
+ * rather than opening the terminfo database. A cache file is only used while
+ * the terminfo file it was loaded from has the same size, mtime and inode.
+ * Keys from a getstr hook are never cached, as there's no telling what they
+ * depend on.
+ *
+ * The file is the header, then the trie cells, then the start and stop
+ * strings each with a terminating NUL. It is only meant to be read on the
+ * machine that wrote it.
+ */
+
+#define CACHE_MAGIC "tkTRIE1"
+#define CACHE_BOM   0x01020304
+#define CACHE_NOSTR 0xffffffff
+
+struct cache_header {
+  char     magic[8];
+  uint32_t bom;
+  uint32_t flags;
+  uint64_t src_size, src_mtime, src_ino;
+  uint32_t ntrie;
+  uint32_t start_len, stop_len; /* CACHE_NOSTR if there is none */
+  uint32_t pad;                 /* keeps the cells 8-byte aligned */
+};
+
+/* Fills path with the cache file name for term, creating the directory for
+ * it if create is set
+ */
+static bool cache_path(char *path, size_t size, const char *term, int flags, bool create)
+{
+  const char *env;
+  char dir[PATH_MAX];
+
+  // Not a name that could escape the directory
+  if(!term || !term[0] || term[0] == '.' || strchr(term, '/'))
+    return false;
+
+  if((env = getenv("XDG_CACHE_HOME")) && env[0]) {
+    if(snprintf(dir, sizeof dir, "%s", env) >= sizeof dir)
+      return false;
+  }
+  else if((env = getenv("HOME"))) {
+    if(snprintf(dir, sizeof dir, "%s/.cache", env) >= sizeof dir)
+      return false;
+  }
+  else
+    return false;
+
+  if(create)
+    mkdir(dir, 0700);
+
+  if(strlen(dir) + sizeof "/libtermkey" > sizeof dir)
+    return false;
+  strcat(dir, "/libtermkey");
+
+  if(create)
+    mkdir(dir, 0700);
+
+  return snprintf(path, size, "%s/%s-%x.trie", dir, term, flags) < size;
+}
+
+static bool header_matches(const struct cache_header *hdr, int flags, const struct stat *src)
+{
+  return memcmp(hdr->magic, CACHE_MAGIC, sizeof hdr->magic) == 0 &&
+         hdr->bom == CACHE_BOM &&
+         hdr->flags == flags &&
+         hdr->src_size  == (uint64_t)src->st_size &&
+         hdr->src_mtime == (uint64_t)src->st_mtime &&
+         hdr->src_ino   == (uint64_t)src->st_ino;
+}
+
+/* Checks the trie cells can be walked without leaving the array. Nodes are
+ * laid out one after another, so a single pass finds where each starts and a
+ * second checks every child offset leads to one of those
+ */
+static bool valid_trie(const uint32_t *cells, size_t ncells)
+{
+  bool ok = false;
+  unsigned char *isnode = calloc(ncells ? ncells : 1, 1);
+  if(!isnode)
+    return false;
+
+  size_t n = 0;
+  while(n < ncells) {
+    uint32_t hdr = cells[n];
+    isnode[n] = 1;
+
+    if(hdr == TRIE_KEY)
+      n += 1 + TRIE_KEYCELLS;
+    else if(hdr >> 16)
+      goto out;
+    else {
+      unsigned char min = hdr & 0xff, max = (hdr >> 8) & 0xff;
+      n += 1 + (min <= max ? max - min + 1 : 0);
+    }
+  }
+  if(n != ncells || !ncells)
+    goto out;
+
+  for(n = 0; n < ncells; n++) {
+    if(!isnode[n] || cells[n] == TRIE_KEY)
+      continue;
+
+    unsigned char min = cells[n] & 0xff, max = (cells[n] >> 8) & 0xff;
+    for(int b = min; b <= max; b++) {
+      uint32_t child = cells[n + 1 + b - min];
+      if(child && (child <= n || child >= ncells || !isnode[child]))
+        goto out;
+    }
+  }
+
+  ok = true;
+
+out:
+  free(isnode);
+  return ok;
+}
+
+static bool cache_string(const char *base, size_t *offp, size_t size, uint32_t len, char **strp)
+{
+  *strp = NULL;
+  if(len == CACHE_NOSTR)
+    return true;
+
+  if(len >= size - *offp || base[*offp + len])
+    return false;
+
+  *strp = (char *)base + *offp;
+  *offp += len + 1;
+  return true;
+}
+
+/* Maps in a valid cache file for this terminal into sh, if there is one */
+static bool load_disk_cache(TermKeyTI *ti, struct ti_shared *sh)
+{
+  char path[PATH_MAX];
+  struct stat src, st;
+
+  if(!find_terminfo(ti->termname, path, sizeof path, &src) ||
+     !cache_path(path, sizeof path, ti->termname, sh->flags, false))
+    return false;
+
+  int fd = open(path, O_RDONLY);
+  if(fd == -1)
+    return false;
+
+  if(fstat(fd, &st) == -1 || st.st_size < sizeof(struct cache_header)) {
+    close(fd);
+    return false;
+  }
+
+  size_t size = st.st_size;
+  void *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if(map == MAP_FAILED)
+    return false;
+
+  const struct cache_header *hdr = map;
+  const char *base = map;
+  size_t off = sizeof(*hdr);
+  char *start_string, *stop_string;
+
+  if(!header_matches(hdr, sh->flags, &src) ||
+     hdr->ntrie > (size - off) / sizeof(uint32_t))
+    goto fail;
+
+  const uint32_t *cells = (const uint32_t *)(base + off);
+  off += hdr->ntrie * sizeof(uint32_t);
+
+  if(!valid_trie(cells, hdr->ntrie) ||
+     !cache_string(base, &off, size, hdr->start_len, &start_string) ||
+     !cache_string(base, &off, size, hdr->stop_len, &stop_string))
+    goto fail;
+
+  sh->map = map;
+  sh->maplen = size;
+  sh->trie = (uint32_t *)cells;
+  sh->ntrie = hdr->ntrie;
+  sh->start_string = start_string;
+  sh->stop_string = stop_string;
+  sh->found = 1;
 
-  ti->term = NULL;
+  return true;
+
+fail:
+  munmap(map, size);
+  return false;
+}
+
+static bool write_all(int fd, const void *buf, size_t len)
+{
+  while(len) {
+    ssize_t written = write(fd, buf, len);
+    if(written == -1)
+      return false;
+    buf = (const char *)buf + written;
+    len -= written;
+  }
+  return true;
+}
+
+/* Writes the freshly-loaded keys in sh to the cache. This is only an
+ * optimisation, so any failure just leaves no cache file. The file appears
+ * under its real name complete, or not at all
+ */
+static void save_disk_cache(TermKeyTI *ti, struct ti_shared *sh)
+{
+  char path[PATH_MAX], tmppath[PATH_MAX + 8];
+  struct stat src;
+
+  if(!find_terminfo(ti->termname, path, sizeof path, &src) ||
+     !cache_path(path, sizeof path, ti->termname, sh->flags, true))
+    return;
+
+  snprintf(tmppath, sizeof tmppath, "%s.XXXXXX", path);
+  int fd = mkstemp(tmppath);
+  if(fd == -1)
+    return;
+
+  struct cache_header hdr = {
+    .magic     = CACHE_MAGIC,
+    .bom       = CACHE_BOM,
+    .flags     = sh->flags,
+    .src_size  = src.st_size,
+    .src_mtime = src.st_mtime,
+    .src_ino   = src.st_ino,
+    .ntrie     = sh->ntrie,
+    .start_len = sh->start_string ? strlen(sh->start_string) : CACHE_NOSTR,
+    .stop_len  = sh->stop_string  ? strlen(sh->stop_string)  : CACHE_NOSTR,
+  };
+
+  bool ok = write_all(fd, &hdr, sizeof hdr) &&
+            write_all(fd, sh->trie, sh->ntrie * sizeof(uint32_t)) &&
+            (!sh->start_string || write_all(fd, sh->start_string, hdr.start_len + 1)) &&
+            (!sh->stop_string  || write_all(fd, sh->stop_string,  hdr.stop_len + 1));
+
+  if(close(fd) == -1)
+    ok = false;
+
+  if(!ok || rename(tmppath, path) == -1)
+    unlink(tmppath);
+}
 #endif
 
-  ti->root = compress_trie(ti->root);
+/* Returns a shared copy of the keys for this instance, loading them if there
+ * isn't one yet. Loading happens under the lock, so concurrent instances
+ * for the same terminal only read it once
+ */
+static struct ti_shared *acquire_shared(TermKeyTI *ti)
+{
+  TermKey *tk = ti->tk;
+  int flags = tk->flags & SHARED_FLAGS;
+  struct ti_shared *sh;
+
+  if(!flags && !tk->ti_getstr_hook && (sh = find_builtin(ti->termname)) &&
+     !has_user_terminfo(ti->termname))
+    return sh;
+
+  LOCK_SHARED();
+
+  if(ti->termname)
+    for(sh = shared_list; sh; sh = sh->next)
+      if(streq(sh->termname, ti->termname) &&
+         sh->hook == tk->ti_getstr_hook &&
+         sh->hook_data == tk->ti_getstr_hook_data &&
+         sh->flags == flags) {
+        sh->refcount++;
+        UNLOCK_SHARED();
+        return sh;
+      }
 
-  return 1;
+  sh = calloc(1, sizeof(*sh));
+  if(!sh)
+    goto unlock;
+
+  sh->refcount = 1;
+  sh->hook = tk->ti_getstr_hook;
+  sh->hook_data = tk->ti_getstr_hook_data;
+  sh->flags = flags;
+
+  bool loaded = false;
+#ifndef _WIN32
+  bool diskcache = (tk->flags & TERMKEY_FLAG_DISKCACHE) && ti->termname && !tk->ti_getstr_hook;
+
+  loaded = diskcache && load_disk_cache(ti, sh);
+#endif
+
+  if(!loaded) {
+    if(!load_terminfo(ti, sh)) {
+      free_shared(sh);
+      sh = NULL;
+      goto unlock;
+    }
+
+#ifndef _WIN32
+    if(diskcache && sh->found)
+      save_disk_cache(ti, sh);
+#endif
+  }
+
+  // Without a name it stays private to this instance
+  if(ti->termname && (sh->termname = strdup(ti->termname))) {
+    sh->next = shared_list;
+    shared_list = sh;
+  }
+
+unlock:
+  UNLOCK_SHARED();
+  return sh;
+}
+
+static void release_shared(struct ti_shared *sh)
+{
+  if(sh->builtin)
+    return;
+
+  LOCK_SHARED();
+
+  if(--sh->refcount) {
+    UNLOCK_SHARED();
+    return;
+  }
+
+  if(sh->termname)
+    for(struct ti_shared **pp = &shared_list; *pp; pp = &(*pp)->next)
+      if(*pp == sh) {
+        *pp = sh->next;
+        break;
+      }
+
+  UNLOCK_SHARED();
+
+  free_shared(sh);
 }
 
 static void *new_driver(TermKey *tk, const char *term)
@@ -405,48 +1061,43 @@ static void *new_driver(TermKey *tk, const char *term)
     return NULL;
 
   ti->tk = tk;
-  ti->root = NULL;
-  ti->start_string = NULL;
-  ti->stop_string = NULL;
-
-#ifdef HAVE_UNIBILIUM
-  ti->unibi = unibi_from_term(term);
-  int saved_errno = errno;
-  if(!ti->unibi && saved_errno != ENOENT) {
-    free(ti);
-    return NULL;
-  }
-  /* ti->unibi may be NULL if errno == ENOENT. That means the terminal wasn't
-   * known. Lets keep going because if we get getstr hook that might invent
-   * new strings for us
-   */
-#else
-  {
-    int err;
-
-    ti->term = NULL;
-
-    /* Have to cast away the const. But it's OK - we know terminfo won't really
-    * modify term */
-    if(setupterm((char*)term, 1, &err) == OK)
-      ti->term = strdup(term);
-  }
-#endif
+  ti->termname = term ? strdup(term) : NULL;
+  ti->entries = NULL;
+  ti->nentries = ti->entriessize = 0;
+  ti->shared = NULL;
+  ti->trie = NULL;
+  ti->tinfo = NULL;
 
   return ti;
 }
 
+static void load_keys(TermKeyTI *ti)
+{
+  ti->shared = acquire_shared(ti);
+  if(ti->shared)
+    ti->trie = ti->shared->trie;
+}
+
 static int start_driver(TermKey *tk, void *info)
 {
   TermKeyTI *ti = info;
   struct stat statbuf;
-  char *start_string;
+  const char *start_string;
   size_t len;
 
-  if(!ti->root)
-    load_terminfo(ti);
+  /* Lazily, the terminal is left in its normal keypad mode, whose keys the
+   * CSI driver understands; terminfo is only loaded once it doesn't
+   */
+  if(tk->flags & TERMKEY_FLAG_LAZYTERMINFO) {
+    if(!ti->shared)
+      tk->driver_deferred = 1;
+    return 1;
+  }
 
-  start_string = ti->start_string;
+  if(!ti->shared)
+    load_keys(ti);
+
+  start_string = ti->shared ? ti->shared->start_string : NULL;
 
   if(tk->fd == -1 || !start_string)
     return 1;
@@ -480,10 +1131,10 @@ static int stop_driver(TermKey *tk, void *info)
 {
   TermKeyTI *ti = info;
   struct stat statbuf;
-  char *stop_string = ti->stop_string;
+  const char *stop_string = ti->shared ? ti->shared->stop_string : NULL;
   size_t len;
 
-  if(tk->fd == -1 || !stop_string)
+  if(tk->fd == -1 || !stop_string || (tk->flags & TERMKEY_FLAG_LAZYTERMINFO))
     return 1;
 
   /* There's no point trying to write() to a pipe */
@@ -515,27 +1166,16 @@ static void free_driver(void *info)
 {
   TermKeyTI *ti = info;
 
-  free_trie(ti->root);
+  free_entries(ti);
 
-  if(ti->start_string)
-    free(ti->start_string);
+  if(ti->shared)
+    release_shared(ti->shared);
 
-  if(ti->stop_string)
-    free(ti->stop_string);
-
-#ifdef HAVE_UNIBILIUM
-  if(ti->unibi)
-    unibi_destroy(ti->unibi);
-#else
-  if(ti->term)
-    free(ti->term);
-#endif
+  free(ti->termname);
 
   free(ti);
 }
 
-#define CHARAT(i) (tk->buffer[tk->buffstart + (i)])
-
 static TermKeyResult peekkey(TermKey *tk, void *info, TermKeyKey *key, int force, size_t *nbytep)
 {
   TermKeyTI *ti = info;
@@ -543,28 +1183,30 @@ static TermKeyResult peekkey(TermKey *tk, void *info, TermKeyKey *key, int force
   if(tk->buffcount == 0)
     return tk->is_closed ? TERMKEY_RES_EOF : TERMKEY_RES_NONE;
 
-  struct trie_node *p = ti->root;
+  const uint32_t *cells = ti->trie;
+  if(!cells)
+    return TERMKEY_RES_NONE;
+
+  uint32_t n = 0;
 
   unsigned int pos = 0;
   while(pos < tk->buffcount) {
-    p = lookup_next(p, CHARAT(pos));
-    if(!p)
+    n = trie_next(cells, n, CHARAT(pos));
+    if(!n)
       break;
 
     pos++;
 
-    if(p->type != TYPE_KEY)
+    if(!(cells[n] & TRIE_KEY))
       continue;
 
-    struct trie_node_key *nk = (struct trie_node_key*)p;
-    if(nk->key.type == TERMKEY_TYPE_MOUSE) {
-      tk->buffstart += pos;
-      tk->buffcount -= pos;
+    TermKeyType type = cells[n+1];
+    if(type == TERMKEY_TYPE_MOUSE) {
+      termkey_buffer_skip(tk, pos);
 
       TermKeyResult mouse_result = (*tk->method.peekkey_mouse)(tk, key, nbytep);
 
-      tk->buffstart -= pos;
-      tk->buffcount += pos;
+      termkey_buffer_unskip(tk, pos);
 
       if(mouse_result == TERMKEY_RES_KEY)
         *nbytep += pos;
@@ -572,72 +1214,97 @@ static TermKeyResult peekkey(TermKey *tk, void *info, TermKeyKey *key, int force
       return mouse_result;
     }
 
-    key->type      = nk->key.type;
-    key->code.sym  = nk->key.sym;
-    key->modifiers = nk->key.modifier_set;
+    key->type      = type;
+    key->code.sym  = (int32_t)cells[n+2];
+    key->modifiers = cells[n+4];
     *nbytep = pos;
     return TERMKEY_RES_KEY;
   }
 
-  // If p is not NULL then we hadn't walked off the end yet, so we have a
+  // If n is not 0 then we hadn't walked off the end yet, so we have a
   // partial match
-  if(p && !force)
+  if(n && !force)
     return TERMKEY_RES_AGAIN;
 
   return TERMKEY_RES_NONE;
 }
 
-static int insert_seq(TermKeyTI *ti, const char *seq, struct trie_node *node)
+#ifdef TERMKEY_MKBUILTIN
+static void dump_string(FILE *out, const char *str)
 {
-  int pos = 0;
-  struct trie_node *p = ti->root;
-
-  // Unsigned because we'll be using it as an array subscript
-  unsigned char b;
-
-  while((b = seq[pos])) {
-    struct trie_node *next = lookup_next(p, b);
-    if(!next)
-      break;
-    p = next;
-    pos++;
+  if(!str) {
+    fputs("NULL", out);
+    return;
   }
 
-  while((b = seq[pos])) {
-    struct trie_node *next;
-    if(seq[pos+1])
-      // Intermediate node
-      next = new_node_arr(0, 0xff);
+  fputc('"', out);
+  for(; *str; str++) {
+    unsigned char c = *str;
+    if(c == '"' || c == '\\')
+      fprintf(out, "\\%c", c);
+    else if(c < 0x20 || c >= 0x7f)
+      fprintf(out, "\\%03o", c);
     else
-      // Final key node
-      next = node;
+      fputc(c, out);
+  }
+  fputc('"', out);
+}
 
-    if(!next)
-      return 0;
+int termkey_ti_dump_builtin(TermKey *tk, FILE *out, int index)
+{
+  struct TermKeyDriverNode *p;
+  for(p = tk->drivers; p; p = p->next)
+    if(p->driver == &termkey_driver_ti)
+      break;
 
-    switch(p->type) {
-    case TYPE_ARR:
-      {
-        struct trie_node_arr *nar = (struct trie_node_arr*)p;
-        if(b < nar->min || b > nar->max) {
-          fprintf(stderr, "ASSERT FAIL: Trie insert at 0x%02x is outside of extent bounds (0x%02x..0x%02x)\n",
-              b, nar->min, nar->max);
-          abort();
-        }
-        nar->arr[b - nar->min] = next;
-        p = next;
-        break;
-      }
-    case TYPE_KEY:
-      fprintf(stderr, "ASSERT FAIL: Tried to insert child node in TYPE_KEY\n");
-      abort();
-    }
+  if(!p)
+    return 0;
 
-    pos++;
-  }
+  TermKeyTI *ti = p->info;
+  struct ti_shared *sh = ti->shared;
+  if(!sh || !sh->found)
+    return 0;
+
+  fprintf(out, "\nstatic const uint32_t builtin_trie_%d[] = {", index);
+  for(size_t i = 0; i < sh->ntrie; i++)
+    fprintf(out, "%s0x%08x,", i % 8 ? " " : "\n  ", sh->trie[i]);
+  fprintf(out, "\n};\n");
+
+  fprintf(out, "\nstatic struct ti_shared builtin_%d = {\n", index);
+  fprintf(out, "  .termname     = ");
+  dump_string(out, ti->termname);
+  fprintf(out, ",\n  .found        = 1,\n  .builtin      = 1,\n");
+  fprintf(out, "  .trie         = (uint32_t *)builtin_trie_%d,\n", index);
+  fprintf(out, "  .ntrie        = %zu,\n", sh->ntrie);
+  fprintf(out, "  .start_string = ");
+  dump_string(out, sh->start_string);
+  fprintf(out, ",\n  .stop_string  = ");
+  dump_string(out, sh->stop_string);
+  fprintf(out, ",\n};\n");
 
   return 1;
 }
+#endif
+
+static int may_start(TermKey *tk, void *info, unsigned char byte)
+{
+  TermKeyTI *ti = info;
+
+  return ti->trie && trie_next(ti->trie, 0, byte);
+}
+
+static int load_deferred(TermKey *tk, void *info)
+{
+  TermKeyTI *ti = info;
+
+  if(ti->shared)
+    return 0;
+
+  load_keys(ti);
+
+  // A trie that is just an empty root has nothing to offer
+  return ti->shared && ti->shared->ntrie > 1;
+}
 
 struct TermKeyDriver termkey_driver_ti = {
   .name        = "terminfo",
@@ -648,5 +1315,8 @@ struct TermKeyDriver termkey_driver_ti = {
   .start_driver = start_driver,
   .stop_driver  = stop_driver,
 
-  .peekkey = peekkey,
+  .peekkey   = peekkey,
+  .may_start = may_start,
+
+  .load_deferred = load_deferred,
 };
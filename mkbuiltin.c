@@ -0,0 +1,36 @@
+/* Writes termkey-builtin.inc to stdout: the keys for each terminal named on
+ * the command line, as loaded from this machine's terminfo, in the form the
+ * terminfo driver can use without loading anything. Terminals terminfo
+ * doesn't know are left out.
+ */
+
+#include "termkey.h"
+#include "termkey-internal.h"
+
+#include <stdio.h>
+
+int main(int argc, char *argv[])
+{
+  int n = 0;
+
+  printf("/* Generated by mkbuiltin; do not edit */\n");
+
+  for(int i = 1; i < argc; i++) {
+    TermKey *tk = termkey_new_abstract(argv[i], 0);
+
+    if(tk && termkey_ti_dump_builtin(tk, stdout, n))
+      n++;
+    else
+      fprintf(stderr, "mkbuiltin: no terminfo for %s; leaving it out\n", argv[i]);
+
+    if(tk)
+      termkey_destroy(tk);
+  }
+
+  printf("\nstatic struct ti_shared *const builtin_ti[] = {\n");
+  for(int i = 0; i < n; i++)
+    printf("  &builtin_%d,\n", i);
+  printf("  NULL,\n};\n");
+
+  return 0;
+}
@@ -7,7 +7,7 @@ int main(int argc, char *argv[])
   TermKey   *tk;
   TermKeyKey key;
 
-  plan_tests(9);
+  plan_tests(27);
 
   tk = termkey_new_abstract("vt100", 0);
 
@@ -26,6 +26,62 @@ int main(int argc, char *argv[])
 
   is_int(termkey_getkey(tk, &key), TERMKEY_RES_KEY, "buffered key still useable after resize");
 
+  termkey_set_flags(tk, TERMKEY_FLAG_UTF8);
+  ok(!!termkey_set_buffer_size(tk, 8), "buffer set size 8 OK");
+
+  termkey_push_bytes(tk, "abcdef", 6);
+  while(termkey_getkey(tk, &key) == TERMKEY_RES_KEY && key.code.codepoint != 'e')
+    ;
+
+  /* Only 'f' remains at the end of the buffer, so these wrap around it */
+  is_int(termkey_push_bytes(tk, "\xE2\x82\xAC\033[A", 6), 6, "push_bytes wraps around the buffer");
+  is_int(termkey_get_buffer_remaining(tk), 1, "buffer free 1 after wrapping push_bytes");
+
+  termkey_getkey(tk, &key);
+  is_int(key.code.codepoint, 'f', "key before wrap point");
+
+  is_int(termkey_getkey(tk, &key), TERMKEY_RES_KEY, "getkey yields RES_KEY for UTF-8 across wrap");
+  is_int(key.code.codepoint, 0x20AC, "key.code.codepoint for UTF-8 across wrap");
+
+  is_int(termkey_getkey(tk, &key), TERMKEY_RES_KEY, "getkey yields RES_KEY for CSI after wrap");
+  is_int(key.code.sym, TERMKEY_SYM_UP, "key.code.sym for CSI after wrap");
+
+  termkey_set_buffer_limit(tk, 64);
+  is_int(termkey_get_buffer_limit(tk), 64, "buffer limit 64");
+
+  is_int(termkey_push_bytes(tk, "0123456789abcdefghij", 20), 20, "push_bytes grows adaptive buffer");
+  is_int(termkey_get_buffer_size(tk), 32, "buffer size doubled to 32");
+  is_int(termkey_get_buffer_highwater(tk), 20, "buffer highwater 20");
+
+  is_int(termkey_push_bytes(tk, "0123456789abcdefghij0123456789abcdefghij0123456789", 50), 44, "push_bytes stops growing at limit");
+  is_int(termkey_get_buffer_size(tk), 64, "buffer size at limit");
+
+  while(termkey_getkey(tk, &key) == TERMKEY_RES_KEY)
+    ;
+  termkey_push_bytes(tk, "x", 1);
+  while(termkey_getkey(tk, &key) == TERMKEY_RES_KEY)
+    ;
+
+  is_int(termkey_get_buffer_size(tk), 64, "buffer size kept after one small burst");
+
+  /* Alternating large and small bursts don't resize it each time */
+  for(int i = 0; i < 20; i++) {
+    termkey_push_bytes(tk, i % 2 ? "x" : "0123456789abcdefghij0123456789abcdefghij", i % 2 ? 1 : 40);
+    while(termkey_getkey(tk, &key) == TERMKEY_RES_KEY)
+      ;
+  }
+
+  is_int(termkey_get_buffer_size(tk), 64, "buffer size kept with alternating bursts");
+
+  for(int i = 0; i < 8; i++) {
+    termkey_push_bytes(tk, "x", 1);
+    while(termkey_getkey(tk, &key) == TERMKEY_RES_KEY)
+      ;
+  }
+
+  is_int(termkey_get_buffer_size(tk), 8, "buffer size shrinks after idle");
+  is_int(termkey_get_buffer_highwater(tk), 64, "buffer highwater 64");
+
   termkey_destroy(tk);
 
   return exit_status();
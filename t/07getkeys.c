@@ -0,0 +1,125 @@
+#include <string.h>
+#include "../termkey.h"
+#include "taplib.h"
+
+int main(int argc, char *argv[])
+{
+  TermKey   *tk;
+  TermKeyKey keys[4];
+  size_t     nkeys;
+  const char *str;
+  size_t     len;
+
+  plan_tests(47);
+
+  tk = termkey_new_abstract("vt100", 0);
+
+  is_int(termkey_getkeys(tk, keys, 4, &nkeys), TERMKEY_RES_NONE, "getkeys yields RES_NONE when empty");
+  is_int(nkeys, 0, "nkeys 0 when empty");
+
+  termkey_push_bytes(tk, "ab\033[A", 5);
+
+  is_int(termkey_getkeys(tk, keys, 4, &nkeys), TERMKEY_RES_NONE, "getkeys yields RES_NONE after draining buffer");
+  is_int(nkeys, 3, "nkeys 3 after ab Up");
+
+  is_int(keys[0].type,           TERMKEY_TYPE_UNICODE, "keys[0].type after ab Up");
+  is_int(keys[0].code.codepoint, 'a',                  "keys[0].code.codepoint after ab Up");
+  is_int(keys[1].code.codepoint, 'b',                  "keys[1].code.codepoint after ab Up");
+  is_int(keys[2].type,           TERMKEY_TYPE_KEYSYM,  "keys[2].type after ab Up");
+  is_int(keys[2].code.sym,       TERMKEY_SYM_UP,       "keys[2].code.sym after ab Up");
+
+  is_int(termkey_get_buffer_remaining(tk), 256, "buffer free 256 after getkeys");
+
+  termkey_push_bytes(tk, "abcde", 5);
+
+  is_int(termkey_getkeys(tk, keys, 4, &nkeys), TERMKEY_RES_KEY, "getkeys yields RES_KEY when array fills");
+  is_int(nkeys, 4, "nkeys 4 when array fills");
+  is_int(keys[3].code.codepoint, 'd', "keys[3].code.codepoint when array fills");
+
+  is_int(termkey_getkeys(tk, keys, 4, &nkeys), TERMKEY_RES_NONE, "getkeys yields RES_NONE for remainder");
+  is_int(nkeys, 1, "nkeys 1 for remainder");
+  is_int(keys[0].code.codepoint, 'e', "keys[0].code.codepoint for remainder");
+
+  termkey_push_bytes(tk, "x\033O", 3);
+
+  is_int(termkey_getkeys(tk, keys, 4, &nkeys), TERMKEY_RES_AGAIN, "getkeys yields RES_AGAIN after partial");
+  is_int(nkeys, 1, "nkeys 1 after partial");
+  is_int(keys[1].modifiers, TERMKEY_KEYMOD_ALT, "keys[1] holds forced interpretation after partial");
+
+  termkey_push_bytes(tk, "C", 1);
+
+  is_int(termkey_getkeys(tk, keys, 4, &nkeys), TERMKEY_RES_NONE, "getkeys yields RES_NONE after completion");
+  is_int(keys[0].code.sym, TERMKEY_SYM_RIGHT, "keys[0].code.sym after completion");
+
+  termkey_push_bytes(tk, "\033[5;25vz", 8);
+
+  is_int(termkey_getkeys(tk, keys, 4, &nkeys), TERMKEY_RES_KEY, "getkeys yields RES_KEY after unknown CSI");
+  is_int(nkeys, 1, "unknown CSI ends the batch");
+
+  termkey_destroy(tk);
+
+  tk = termkey_new_abstract("vt100", TERMKEY_FLAG_UTF8);
+
+  is_int(termkey_gettext(tk, &str, &len), TERMKEY_RES_NONE, "gettext yields RES_NONE when empty");
+
+  termkey_push_bytes(tk, "The quick brown fox jumps over the lazy dog\x1b[A", 46);
+
+  is_int(termkey_gettext(tk, &str, &len), TERMKEY_RES_KEY, "gettext yields RES_KEY for text");
+  is_int(len, 43, "gettext length stops before ESC");
+  ok(memcmp(str, "The quick brown fox jumps over the lazy dog", 43) == 0, "gettext text");
+
+  is_int(termkey_gettext(tk, &str, &len), TERMKEY_RES_NONE, "gettext yields RES_NONE at ESC");
+  is_int(termkey_getkey(tk, &keys[0]), TERMKEY_RES_KEY, "getkey yields RES_KEY after text");
+  is_int(keys[0].code.sym, TERMKEY_SYM_UP, "keys[0].code.sym after text");
+
+  termkey_push_bytes(tk, "caf\xc3\xa9 \xc2\x85", 8);
+
+  is_int(termkey_gettext(tk, &str, &len), TERMKEY_RES_KEY, "gettext yields RES_KEY for UTF-8 text");
+  is_int(len, 6, "gettext length stops before UTF-8 C1");
+  ok(memcmp(str, "caf\xc3\xa9 ", 6) == 0, "gettext UTF-8 text");
+
+  is_int(termkey_gettext(tk, &str, &len), TERMKEY_RES_NONE, "gettext yields RES_NONE at UTF-8 C1");
+  termkey_getkey(tk, &keys[0]);
+
+  termkey_push_bytes(tk, "ab\xe2\x82", 4);
+
+  is_int(termkey_gettext(tk, &str, &len), TERMKEY_RES_KEY, "gettext yields RES_KEY before partial UTF-8");
+  is_int(len, 2, "gettext length stops before partial UTF-8");
+  is_int(termkey_gettext(tk, &str, &len), TERMKEY_RES_NONE, "gettext yields RES_NONE at partial UTF-8");
+
+  termkey_push_bytes(tk, "\xac", 1);
+
+  is_int(termkey_gettext(tk, &str, &len), TERMKEY_RES_KEY, "gettext yields RES_KEY for completed UTF-8");
+  is_int(len, 3, "gettext length for completed UTF-8");
+
+  /* More characters than one bulk UTF-8 decode takes at once */
+  termkey_push_bytes(tk, "\xe6\x97\xa5\xe6\x9c\xac\xe8\xaa\x9e\xe6\x97\xa5\xe6\x9c\xac\xe8\xaa\x9e"
+                         "\xe6\x97\xa5\xe6\x9c\xac\xe8\xaa\x9e\xe6\x97\xa5\xe6\x9c\xac\xe8\xaa\x9e"
+                         "\xe6\x97\xa5\xe6\x9c\xac\xe8\xaa\x9e\xe6\x97\xa5\xe6\x9c\xac\xe8\xaa\x9e"
+                         "\xe6\x97\xa5\xe6\x9c\xacx\xed\xa0\x80", 64);
+
+  is_int(termkey_gettext(tk, &str, &len), TERMKEY_RES_KEY, "gettext yields RES_KEY for long UTF-8 text");
+  is_int(len, 61, "gettext length stops before surrogate");
+
+  is_int(termkey_getkey(tk, &keys[0]), TERMKEY_RES_KEY, "getkey yields RES_KEY for surrogate");
+  is_int(keys[0].code.codepoint, 0xfffd, "surrogate decodes as U+FFFD");
+
+  termkey_set_canonflags(tk, TERMKEY_CANON_SPACESYMBOL);
+  termkey_push_bytes(tk, "ab cd", 5);
+
+  is_int(termkey_gettext(tk, &str, &len), TERMKEY_RES_KEY, "gettext yields RES_KEY with SPACESYMBOL");
+  is_int(len, 2, "gettext length stops before space with SPACESYMBOL");
+
+  termkey_destroy(tk);
+
+  tk = termkey_new_abstract("vt100", TERMKEY_FLAG_RAW);
+
+  termkey_push_bytes(tk, "\xa9z\x85", 3);
+
+  is_int(termkey_gettext(tk, &str, &len), TERMKEY_RES_KEY, "gettext yields RES_KEY for raw text");
+  is_int(len, 2, "gettext length stops before raw C1");
+
+  termkey_destroy(tk);
+
+  return exit_status();
+}
@@ -0,0 +1,70 @@
+#include <errno.h>
+
+#include "../termkey.h"
+#include "taplib.h"
+
+int main(int argc, char *argv[])
+{
+  TermKey   *tk;
+  TermKeyKey keys[4];
+  size_t     nkeys;
+  long       args[16];
+  size_t     nargs = 16;
+  unsigned long command;
+
+  plan_tests(30);
+
+  tk = termkey_new_abstract("vt100", 0);
+
+  is_int(termkey_decode_bytes(tk, "ab\033[A", 5, keys, 4, &nkeys), 5, "decode_bytes consumes ab Up");
+  is_int(nkeys, 3, "nkeys 3 after ab Up");
+  is_int(keys[0].code.codepoint, 'a',            "keys[0].code.codepoint after ab Up");
+  is_int(keys[1].code.codepoint, 'b',            "keys[1].code.codepoint after ab Up");
+  is_int(keys[2].type,           TERMKEY_TYPE_KEYSYM, "keys[2].type after ab Up");
+  is_int(keys[2].code.sym,       TERMKEY_SYM_UP, "keys[2].code.sym after ab Up");
+
+  is_int(termkey_get_buffer_remaining(tk), 256, "buffer free 256 after decode_bytes");
+
+  is_int(termkey_decode_bytes(tk, "abcdef", 6, keys, 4, &nkeys), 4, "decode_bytes stops when array fills");
+  is_int(nkeys, 4, "nkeys 4 when array fills");
+  is_int(termkey_get_buffer_remaining(tk), 256, "unconsumed bytes not copied when array fills");
+
+  is_int(termkey_decode_bytes(tk, "x\033[", 3, keys, 4, &nkeys), 3, "decode_bytes consumes partial sequence");
+  is_int(nkeys, 1, "nkeys 1 before partial sequence");
+  is_int(termkey_get_buffer_remaining(tk), 254, "only partial sequence copied into buffer");
+
+  is_int(termkey_getkey(tk, &keys[0]), TERMKEY_RES_AGAIN, "getkey yields RES_AGAIN for partial sequence");
+
+  is_int(termkey_decode_bytes(tk, "By", 2, keys, 4, &nkeys), 2, "decode_bytes consumes rest of sequence");
+  is_int(nkeys, 2, "nkeys 2 after completing sequence");
+  is_int(keys[0].code.sym,       TERMKEY_SYM_DOWN, "keys[0].code.sym after completing sequence");
+  is_int(keys[1].code.codepoint, 'y',              "keys[1].code.codepoint after completing sequence");
+  is_int(termkey_get_buffer_remaining(tk), 256, "buffer empty after completing sequence");
+
+  is_int(termkey_decode_bytes(tk, "\033[?3zq", 6, keys, 4, &nkeys), 5, "decode_bytes stops after unknown CSI");
+  is_int(nkeys, 1, "nkeys 1 for unknown CSI");
+  is_int(keys[0].type, TERMKEY_TYPE_UNKNOWN_CSI, "keys[0].type for unknown CSI");
+
+  is_int(termkey_interpret_csi(tk, &keys[0], args, &nargs, &command), TERMKEY_RES_KEY, "interpret_csi yields RES_KEY");
+  is_int(args[0], 3, "args[0] for unknown CSI");
+  is_int(command, '?'<<8 | 'z', "command for unknown CSI");
+
+  is_int(termkey_decode_bytes(tk, "q", 1, keys, 4, &nkeys), 1, "decode_bytes after unknown CSI");
+  is_int(nkeys, 1, "nkeys 1 after unknown CSI");
+  is_int(keys[0].code.codepoint, 'q', "keys[0].code.codepoint after unknown CSI");
+
+  termkey_destroy(tk);
+
+  /* Bytes that must be buffered but don't fit are an error, not a short count */
+  tk = termkey_new_abstract("vt100", 0);
+  termkey_set_buffer_size(tk, 8);
+
+  termkey_push_bytes(tk, "\033[1;2;3;", 8);
+  errno = 0;
+  ok(termkey_decode_bytes(tk, "4A", 2, keys, 4, &nkeys) == (size_t)-1, "decode_bytes yields -1 when the buffer is full");
+  is_int(errno, ENOMEM, "errno ENOMEM when the buffer is full");
+
+  termkey_destroy(tk);
+
+  return exit_status();
+}
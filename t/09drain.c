@@ -0,0 +1,92 @@
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "../termkey.h"
+#include "taplib.h"
+
+int main(int argc, char *argv[])
+{
+  int        fd[2];
+  TermKey   *tk;
+  TermKeyKey keys[64];
+  size_t     nkeys;
+
+  plan_tests(24);
+
+  /* Draining reads until EAGAIN, so the read end must be non-blocking */
+  pipe(fd);
+  fcntl(fd[0], F_SETFL, fcntl(fd[0], F_GETFL) | O_NONBLOCK);
+
+  tk = termkey_new(fd[0], TERMKEY_FLAG_NOTERMIOS|TERMKEY_FLAG_DRAIN);
+  termkey_set_buffer_size(tk, 16);
+
+  is_int(termkey_advisereadable(tk), TERMKEY_RES_NONE, "advisereadable yields RES_NONE when empty");
+
+  write(fd[1], "abcdefgh", 8);
+
+  is_int(termkey_advisereadable(tk), TERMKEY_RES_AGAIN, "advisereadable yields RES_AGAIN after abcdefgh");
+  is_int(termkey_getkeys(tk, keys, 4, &nkeys), TERMKEY_RES_KEY, "getkeys yields RES_KEY for abcd");
+
+  /* The 4 valid bytes now sit in the middle of the ring, so this read has to
+   * fill both the end and the start of it */
+  write(fd[1], "ijklmnopqrstuvwxyz", 18);
+
+  is_int(termkey_advisereadable(tk), TERMKEY_RES_AGAIN, "advisereadable yields RES_AGAIN when buffer fills");
+  is_int(termkey_get_buffer_remaining(tk), 0, "buffer full after first drain");
+
+  is_int(termkey_getkeys(tk, keys, 64, &nkeys), TERMKEY_RES_NONE, "getkeys yields RES_NONE after first drain");
+  is_int(nkeys, 16, "nkeys 16 after first drain");
+  is_int(keys[0].code.codepoint,  'e', "keys[0].code.codepoint after first drain");
+  is_int(keys[15].code.codepoint, 't', "keys[15].code.codepoint after first drain");
+
+  is_int(termkey_advisereadable(tk), TERMKEY_RES_AGAIN, "advisereadable yields RES_AGAIN for rest");
+  is_int(termkey_getkeys(tk, keys, 64, &nkeys), TERMKEY_RES_NONE, "getkeys yields RES_NONE for rest");
+  is_int(keys[5].code.codepoint, 'z', "keys[5].code.codepoint for rest");
+
+  is_int(termkey_advisereadable(tk), TERMKEY_RES_NONE, "advisereadable yields RES_NONE once drained");
+
+  termkey_set_buffer_limit(tk, 256);
+
+  write(fd[1], "abcdefghijklmnopqrstuvwxyz", 26);
+
+  is_int(termkey_advisereadable(tk), TERMKEY_RES_AGAIN, "advisereadable yields RES_AGAIN with adaptive buffer");
+  is_int(termkey_getkeys(tk, keys, 64, &nkeys), TERMKEY_RES_NONE, "getkeys yields RES_NONE with adaptive buffer");
+  is_int(nkeys, 26, "adaptive buffer grows to take all input in one call");
+
+  termkey_set_read_budget(tk, 10);
+  is_int(termkey_get_read_budget(tk), 10, "get_read_budget");
+
+  write(fd[1], "abcdefghijklmnopqrstuvwxyz", 26);
+
+  is_int(termkey_advisereadable(tk), TERMKEY_RES_AGAIN, "advisereadable yields RES_AGAIN with budget");
+  is_int(termkey_getkeys(tk, keys, 64, &nkeys), TERMKEY_RES_NONE, "getkeys yields RES_NONE with budget");
+  is_int(nkeys, 10, "budget limits bytes read");
+
+  termkey_set_read_budget(tk, 0);
+
+  close(fd[1]);
+
+  is_int(termkey_advisereadable(tk), TERMKEY_RES_AGAIN, "advisereadable yields RES_AGAIN for remainder before EOF");
+  is_int(termkey_getkeys(tk, keys, 64, &nkeys) == TERMKEY_RES_EOF && nkeys == 16, 1, "getkeys yields remainder then RES_EOF");
+
+  termkey_destroy(tk);
+
+  /* On a blocking filehandle, a second read would wait for more input */
+  pipe(fd);
+
+  tk = termkey_new(fd[0], TERMKEY_FLAG_NOTERMIOS|TERMKEY_FLAG_DRAIN);
+
+  write(fd[1], "a", 1);
+  alarm(5);
+
+  is_int(termkey_advisereadable(tk), TERMKEY_RES_AGAIN, "advisereadable yields RES_AGAIN on blocking filehandle");
+  is_int(termkey_getkeys(tk, keys, 64, &nkeys), TERMKEY_RES_NONE, "getkeys yields RES_NONE on blocking filehandle");
+
+  alarm(0);
+
+  termkey_destroy(tk);
+  close(fd[0]);
+  close(fd[1]);
+
+  return exit_status();
+}
@@ -0,0 +1,175 @@
+#include <string.h>
+#include "../termkey.h"
+#include "taplib.h"
+
+int main(int argc, char *argv[])
+{
+  TermKey   *tk;
+  TermKeyKey key;
+  const char *str;
+  size_t     len;
+  char       buffer[16];
+
+  plan_tests(77);
+
+  tk = termkey_new_abstract("vt100", 0);
+
+  termkey_push_bytes(tk, "\x1b[200~hello\x1b[201~x", 18);
+
+  is_int(termkey_getkey(tk, &key), TERMKEY_RES_KEY, "getkey yields RES_KEY for paste");
+
+  is_int(key.type,      TERMKEY_TYPE_PASTE, "key.type for paste");
+  is_int(key.modifiers, 0,                  "key.modifiers for paste");
+
+  is_int(termkey_interpret_paste(tk, &key, &str, &len), TERMKEY_RES_KEY, "interpret_paste yields RES_KEY");
+  is_int(len, 5, "interpret_paste length");
+  ok(memcmp(str, "hello", 5) == 0, "interpret_paste body");
+
+  termkey_strfkey(tk, buffer, sizeof buffer, &key, 0);
+  is_str(buffer, "Paste", "strfkey for paste");
+
+  is_int(termkey_getkey(tk, &key), TERMKEY_RES_KEY, "getkey yields RES_KEY after paste");
+  is_int(key.code.codepoint, 'x', "key.code.codepoint after paste");
+
+  termkey_push_bytes(tk, "\x1b[200~ab", 8);
+  is_int(termkey_getkey(tk, &key), TERMKEY_RES_AGAIN, "getkey yields RES_AGAIN for partial paste");
+
+  termkey_push_bytes(tk, "c\x1b[20", 5);
+  is_int(termkey_getkey(tk, &key), TERMKEY_RES_AGAIN, "getkey yields RES_AGAIN for partial terminator");
+
+  termkey_push_bytes(tk, "1~", 2);
+  is_int(termkey_getkey(tk, &key), TERMKEY_RES_KEY, "getkey yields RES_KEY for completed paste");
+  is_int(key.type, TERMKEY_TYPE_PASTE, "key.type for completed paste");
+  is_int(termkey_interpret_paste(tk, &key, &str, &len), TERMKEY_RES_KEY, "interpret_paste yields RES_KEY for completed paste");
+  is_int(len, 3, "interpret_paste length for completed paste");
+  ok(memcmp(str, "abc", 3) == 0, "interpret_paste body for completed paste");
+
+  termkey_push_bytes(tk, "\x1b[200~de", 8);
+  is_int(termkey_getkey(tk, &key), TERMKEY_RES_AGAIN, "getkey yields RES_AGAIN before forcing paste");
+  is_int(termkey_getkey_force(tk, &key), TERMKEY_RES_KEY, "getkey_force yields RES_KEY for partial paste");
+  is_int(key.type, TERMKEY_TYPE_PASTE, "key.type for forced paste");
+  is_int(termkey_interpret_paste(tk, &key, &str, &len), TERMKEY_RES_AGAIN, "interpret_paste yields RES_AGAIN for forced paste");
+  is_int(len, 2, "interpret_paste length for forced paste");
+  ok(memcmp(str, "de", 2) == 0, "interpret_paste body for forced paste");
+
+  termkey_push_bytes(tk, "f\x1b[201~", 7);
+  is_int(termkey_getkey(tk, &key), TERMKEY_RES_KEY, "getkey yields RES_KEY for rest of paste");
+  is_int(key.type, TERMKEY_TYPE_PASTE, "key.type for rest of paste");
+  is_int(termkey_interpret_paste(tk, &key, &str, &len), TERMKEY_RES_KEY, "interpret_paste yields RES_KEY for rest of paste");
+  is_int(len, 1, "interpret_paste length for rest of paste");
+  ok(memcmp(str, "f", 1) == 0, "interpret_paste body for rest of paste");
+
+  termkey_push_bytes(tk, "\x9b" "200~pq" "\x9b" "201~", 12);
+  is_int(termkey_getkey(tk, &key), TERMKEY_RES_KEY, "getkey yields RES_KEY for 8bit paste");
+  is_int(termkey_interpret_paste(tk, &key, &str, &len), TERMKEY_RES_KEY, "interpret_paste yields RES_KEY for 8bit paste");
+  is_int(len, 2, "interpret_paste length for 8bit paste");
+  ok(memcmp(str, "pq", 2) == 0, "interpret_paste body for 8bit paste");
+
+  termkey_destroy(tk);
+
+  tk = termkey_new_abstract("vt100", 0);
+  termkey_set_buffer_size(tk, 16);
+
+  termkey_push_bytes(tk, "\x1b[200~0123456789", 16);
+  is_int(termkey_getkey(tk, &key), TERMKEY_RES_KEY, "getkey yields RES_KEY for paste filling buffer");
+  is_int(termkey_interpret_paste(tk, &key, &str, &len), TERMKEY_RES_AGAIN, "interpret_paste yields RES_AGAIN for paste filling buffer");
+  is_int(len, 10, "interpret_paste length for paste filling buffer");
+
+  termkey_push_bytes(tk, "ab\x1b[201~", 8);
+  is_int(termkey_getkey(tk, &key), TERMKEY_RES_KEY, "getkey yields RES_KEY for rest of long paste");
+  is_int(termkey_interpret_paste(tk, &key, &str, &len), TERMKEY_RES_KEY, "interpret_paste yields RES_KEY for rest of long paste");
+  is_int(len, 2, "interpret_paste length for rest of long paste");
+
+  /* Leave the paste start marker near the end of the ring so the body wraps */
+  termkey_push_bytes(tk, "abcdefgh\x1b[200~", 14);
+  for(int i = 0; i < 8; i++)
+    termkey_getkey(tk, &key);
+
+  termkey_push_bytes(tk, "wxyz\x1b[201~", 10);
+  is_int(termkey_getkey(tk, &key), TERMKEY_RES_KEY, "getkey yields RES_KEY for wrapped paste");
+  is_int(key.type, TERMKEY_TYPE_PASTE, "key.type for wrapped paste");
+  is_int(termkey_interpret_paste(tk, &key, &str, &len), TERMKEY_RES_KEY, "interpret_paste yields RES_KEY for wrapped paste");
+  is_int(len, 4, "interpret_paste length for wrapped paste");
+  ok(memcmp(str, "wxyz", 4) == 0, "interpret_paste body for wrapped paste");
+
+  is_int(termkey_getkey(tk, &key), TERMKEY_RES_NONE, "getkey yields RES_NONE after wrapped paste");
+
+  termkey_destroy(tk);
+
+  /* A paste body continued in a later read belongs to the paste, even where
+   * it looks like a terminfo key */
+  tk = termkey_new_abstract("xterm", 0);
+  termkey_set_buffer_size(tk, 10);
+
+  termkey_push_bytes(tk, "\x1b[200~abcd", 10);
+  is_int(termkey_getkey(tk, &key), TERMKEY_RES_KEY, "getkey yields RES_KEY for paste before terminfo key");
+  is_int(key.type, TERMKEY_TYPE_PASTE, "key.type for paste before terminfo key");
+
+  termkey_push_bytes(tk, "\x1bOB\x1b[201~x", 10);
+  is_int(termkey_getkey(tk, &key), TERMKEY_RES_KEY, "getkey yields RES_KEY for terminfo key in paste");
+  is_int(key.type, TERMKEY_TYPE_PASTE, "key.type for terminfo key in paste");
+  is_int(termkey_interpret_paste(tk, &key, &str, &len), TERMKEY_RES_KEY, "interpret_paste yields RES_KEY for terminfo key in paste");
+  is_int(len, 3, "interpret_paste length for terminfo key in paste");
+  ok(memcmp(str, "\x1bOB", 3) == 0, "interpret_paste body for terminfo key in paste");
+
+  is_int(termkey_getkey(tk, &key), TERMKEY_RES_KEY, "getkey yields RES_KEY after paste with terminfo key");
+  is_int(key.code.codepoint, 'x', "key.code.codepoint after paste with terminfo key");
+
+  termkey_destroy(tk);
+
+  tk = termkey_new_abstract("vt100", TERMKEY_FLAG_STREAMPASTE);
+  termkey_set_buffer_size(tk, 16);
+
+  termkey_push_bytes(tk, "\x1b[200~abc", 9);
+
+  is_int(termkey_getkey(tk, &key), TERMKEY_RES_KEY, "getkey yields RES_KEY for streamed paste start");
+  is_int(key.type, TERMKEY_TYPE_PASTE_START, "key.type for streamed paste start");
+
+  /* A terminator split across reads must not be delivered as data; chunks
+   * also stop where the ring wraps */
+  termkey_push_bytes(tk, "defghijklm\x1b[2", 13);
+
+  is_int(termkey_getkey(tk, &key), TERMKEY_RES_KEY, "getkey yields RES_KEY for chunk up to wrap");
+  is_int(key.type, TERMKEY_TYPE_PASTE_DATA, "key.type for chunk up to wrap");
+  is_int(termkey_interpret_paste(tk, &key, &str, &len), TERMKEY_RES_KEY, "interpret_paste yields RES_KEY for chunk up to wrap");
+  is_int(len, 10, "interpret_paste length for chunk up to wrap");
+  ok(memcmp(str, "abcdefghij", 10) == 0, "interpret_paste body for chunk up to wrap");
+
+  is_int(termkey_getkey(tk, &key), TERMKEY_RES_KEY, "getkey yields RES_KEY for chunk after wrap");
+  is_int(termkey_interpret_paste(tk, &key, &str, &len), TERMKEY_RES_KEY, "interpret_paste yields RES_KEY for chunk after wrap");
+  is_int(len, 3, "interpret_paste length for chunk after wrap");
+  ok(memcmp(str, "klm", 3) == 0, "interpret_paste body for chunk after wrap");
+
+  is_int(termkey_getkey(tk, &key), TERMKEY_RES_AGAIN, "getkey yields RES_AGAIN for partial terminator");
+
+  termkey_push_bytes(tk, "01~x", 4);
+
+  is_int(termkey_getkey(tk, &key), TERMKEY_RES_KEY, "getkey yields RES_KEY for streamed paste end");
+  is_int(key.type, TERMKEY_TYPE_PASTE_END, "key.type for streamed paste end");
+
+  is_int(termkey_getkey(tk, &key), TERMKEY_RES_KEY, "getkey yields RES_KEY after streamed paste");
+  is_int(key.code.codepoint, 'x', "key.code.codepoint after streamed paste");
+
+  termkey_destroy(tk);
+
+  /* Streamed data that looks like a terminfo key is still data */
+  tk = termkey_new_abstract("xterm", TERMKEY_FLAG_STREAMPASTE);
+
+  termkey_push_bytes(tk, "\x1b[200~", 6);
+  is_int(termkey_getkey(tk, &key), TERMKEY_RES_KEY, "getkey yields RES_KEY for paste start before terminfo key");
+  is_int(key.type, TERMKEY_TYPE_PASTE_START, "key.type for paste start before terminfo key");
+
+  termkey_push_bytes(tk, "\x1bOAdef\x1b[201~", 12);
+  is_int(termkey_getkey(tk, &key), TERMKEY_RES_KEY, "getkey yields RES_KEY for streamed terminfo key");
+  is_int(key.type, TERMKEY_TYPE_PASTE_DATA, "key.type for streamed terminfo key");
+  is_int(termkey_interpret_paste(tk, &key, &str, &len), TERMKEY_RES_KEY, "interpret_paste yields RES_KEY for streamed terminfo key");
+  is_int(len, 6, "interpret_paste length for streamed terminfo key");
+  ok(memcmp(str, "\x1bOAdef", 6) == 0, "interpret_paste body for streamed terminfo key");
+
+  is_int(termkey_getkey(tk, &key), TERMKEY_RES_KEY, "getkey yields RES_KEY for paste end after terminfo key");
+  is_int(key.type, TERMKEY_TYPE_PASTE_END, "key.type for paste end after terminfo key");
+
+  termkey_destroy(tk);
+
+  return exit_status();
+}
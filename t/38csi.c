@@ -1,3 +1,6 @@
+#include <limits.h>
+#include <string.h>
+
 #include "../termkey.h"
 #include "taplib.h"
 
@@ -5,11 +8,13 @@ int main(int argc, char *argv[])
 {
   TermKey   *tk;
   TermKeyKey key;
-  long       args[16];
+  long       args[32];
   size_t     nargs = 16;
+  long       subargs[4];
+  size_t     nsubargs;
   unsigned long command;
 
-  plan_tests(15);
+  plan_tests(53);
 
   tk = termkey_new_abstract("vt100", 0);
 
@@ -40,6 +45,116 @@ int main(int argc, char *argv[])
   is_int(termkey_interpret_csi(tk, &key, args, &nargs, &command), TERMKEY_RES_KEY, "interpret_csi yields RES_KEY");
   is_int(command, '$'<<16 | '?'<<8 | 'x', "command for unknown CSI");
 
+  // Split across reads, one byte at a time
+  {
+    const char *seq = "\x1b[12;345v";
+    size_t i;
+    for(i = 0; i < 8; i++) {
+      termkey_push_bytes(tk, seq + i, 1);
+      if(termkey_getkey(tk, &key) != TERMKEY_RES_AGAIN)
+        break;
+    }
+    is_int(i, 8, "getkey yields RES_AGAIN for each partial CSI");
+
+    termkey_push_bytes(tk, seq + 8, 1);
+  }
+
+  is_int(termkey_getkey(tk, &key), TERMKEY_RES_KEY, "getkey yields RES_KEY for split CSI");
+  nargs = 16;
+  is_int(termkey_interpret_csi(tk, &key, args, &nargs, &command), TERMKEY_RES_KEY, "interpret_csi yields RES_KEY");
+  is_int(nargs,      2, "nargs for split CSI");
+  is_int(args[1],  345, "args[1] for split CSI");
+  is_int(command,  'v', "command for split CSI");
+
+  // The whole CSI is eaten, and only as many args as fit are given back
+  termkey_push_bytes(tk, "\x1b[7;8;9vq", 9);
+
+  is_int(termkey_getkey(tk, &key), TERMKEY_RES_KEY, "getkey yields RES_KEY for CSI 7;8;9v");
+  nargs = 2;
+  is_int(termkey_interpret_csi(tk, &key, args, &nargs, &command), TERMKEY_RES_KEY, "interpret_csi yields RES_KEY");
+  is_int(nargs,    2, "nargs limited for CSI 7;8;9v");
+  is_int(args[1],  8, "args[1] for CSI 7;8;9v");
+
+  is_int(termkey_getkey(tk, &key), TERMKEY_RES_KEY, "getkey yields RES_KEY after CSI 7;8;9v");
+  is_int(key.code.codepoint, 'q', "key.code.codepoint after CSI 7;8;9v");
+
+  is_int(termkey_interpret_csi(tk, &key, args, &nargs, &command), TERMKEY_RES_NONE, "interpret_csi yields RES_NONE for text");
+
+  // Colon sub-parameters
+  termkey_push_bytes(tk, "\x1b[97:65:;2:3;:7v", 16);
+
+  is_int(termkey_getkey(tk, &key), TERMKEY_RES_KEY, "getkey yields RES_KEY for CSI with sub-parameters");
+  nargs = 16;
+  is_int(termkey_interpret_csi(tk, &key, args, &nargs, &command), TERMKEY_RES_KEY, "interpret_csi yields RES_KEY");
+  is_int(nargs,    3, "nargs for CSI with sub-parameters");
+  is_int(args[0], 97, "args[0] for CSI with sub-parameters");
+  is_int(args[1],  2, "args[1] for CSI with sub-parameters");
+  is_int(args[2], -1, "args[2] for CSI with sub-parameters");
+
+  nsubargs = 4;
+  is_int(termkey_interpret_csi_subargs(tk, &key, 0, subargs, &nsubargs), TERMKEY_RES_KEY, "interpret_csi_subargs yields RES_KEY for args[0]");
+  is_int(nsubargs,    2, "nsubargs for args[0]");
+  is_int(subargs[0], 65, "subargs[0] for args[0]");
+  is_int(subargs[1], -1, "subargs[1] for args[0]");
+
+  nsubargs = 4;
+  termkey_interpret_csi_subargs(tk, &key, 2, subargs, &nsubargs);
+  is_int(nsubargs,   1, "nsubargs for args[2]");
+  is_int(subargs[0], 7, "subargs[0] for args[2]");
+
+  nsubargs = 4;
+  is_int(termkey_interpret_csi_subargs(tk, &key, 3, subargs, &nsubargs), TERMKEY_RES_NONE, "interpret_csi_subargs yields RES_NONE past the last argument");
+
+  // Sub-parameters don't disturb the argument they follow
+  termkey_push_bytes(tk, "\x1b[1;5:3A", 8);
+
+  is_int(termkey_getkey(tk, &key), TERMKEY_RES_KEY, "getkey yields RES_KEY for CSI 1;5:3A");
+  is_int(key.modifiers, TERMKEY_KEYMOD_CTRL, "key.modifiers for CSI 1;5:3A");
+
+  // An older event with the same command no longer has its args
+  termkey_push_bytes(tk, "\x1b[1v\x1b[2v", 8);
+
+  TermKeyKey oldkey;
+  termkey_getkey(tk, &oldkey);
+  termkey_getkey(tk, &key);
+  nargs = 16;
+  is_int(termkey_interpret_csi(tk, &oldkey, args, &nargs, &command), TERMKEY_RES_NONE, "interpret_csi yields RES_NONE for an older CSI v");
+  nsubargs = 4;
+  is_int(termkey_interpret_csi_subargs(tk, &oldkey, 0, subargs, &nsubargs), TERMKEY_RES_NONE, "interpret_csi_subargs yields RES_NONE for an older CSI v");
+  nargs = 16;
+  termkey_interpret_csi(tk, &key, args, &nargs, &command);
+  ok(nargs == 1 && args[0] == 2, "args for the newer CSI v");
+
+  // A long sub-parameter list doesn't take those of later arguments
+  {
+    char seq[160] = "\x1b[1";
+    for(int i = 0; i < 50; i++)
+      strcat(seq, ":9");
+    strcat(seq, ";5:3A");
+    termkey_push_bytes(tk, seq, strlen(seq));
+  }
+
+  is_int(termkey_getkey(tk, &key), TERMKEY_RES_KEY, "getkey yields RES_KEY for CSI with many sub-parameters");
+  is_int(key.code.sym, TERMKEY_SYM_UP,           "key.code.sym for CSI with many sub-parameters");
+  is_int(key.modifiers, TERMKEY_KEYMOD_CTRL,     "key.modifiers for CSI with many sub-parameters");
+  is_int(key.event,     TERMKEY_KEYEVENT_RELEASE, "key.event for CSI with many sub-parameters");
+
+  // Numbers too large to store saturate
+  termkey_push_bytes(tk, "\x1b[99999999999999999999999;1v", 28);
+
+  is_int(termkey_getkey(tk, &key), TERMKEY_RES_KEY, "getkey yields RES_KEY for CSI with a huge argument");
+  nargs = 16;
+  termkey_interpret_csi(tk, &key, args, &nargs, &command);
+  ok(nargs == 2 && args[0] == LONG_MAX / 10 && args[1] == 1, "args for CSI with a huge argument");
+
+  // More than 16 arguments
+  termkey_push_bytes(tk, "\x1b[1;2;3;4;5;6;7;8;9;10;11;12;13;14;15;16;17;18;19;20v", 53);
+
+  termkey_getkey(tk, &key);
+  nargs = 32;
+  termkey_interpret_csi(tk, &key, args, &nargs, &command);
+  ok(nargs == 20 && args[19] == 20, "all 20 args for a long CSI");
+
   termkey_destroy(tk);
 
   return exit_status();
@@ -7,7 +7,7 @@ int main(int argc, char *argv[])
   TermKeyKey key;
   const char *str;
 
-  plan_tests(23);
+  plan_tests(28);
 
   tk = termkey_new_abstract("xterm", 0);
 
@@ -50,6 +50,19 @@ int main(int argc, char *argv[])
 
   is_int(termkey_getkey(tk, &key), TERMKEY_RES_NONE, "getkey again yields RES_NONE");
 
+  // OSC split across several reads, with the ST itself split
+  termkey_push_bytes(tk, "\x1b]2;ti", 6);
+  is_int(termkey_getkey(tk, &key), TERMKEY_RES_AGAIN, "getkey yields RES_AGAIN for partial OSC");
+
+  termkey_push_bytes(tk, "tle\x1b", 4);
+  is_int(termkey_getkey(tk, &key), TERMKEY_RES_AGAIN, "getkey yields RES_AGAIN for OSC up to ESC");
+
+  termkey_push_bytes(tk, "\\", 1);
+  is_int(termkey_getkey(tk, &key), TERMKEY_RES_KEY, "getkey yields RES_KEY for split OSC");
+
+  is_int(termkey_interpret_string(tk, &key, &str), TERMKEY_RES_KEY, "termkey_interpret_string() gives string");
+  is_str(str, "2;title", "termkey_interpret_string() yields correct string for split OSC");
+
   // False alarm
   termkey_push_bytes(tk, "\x1bP", 2);
 
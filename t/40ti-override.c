@@ -11,6 +11,9 @@ static const char *backspace_is_X(const char *name, const char *val, void *_)
 {
   if(streq(name, "key_backspace"))
     return "X";
+  /* Conflicts with key_backspace, which is loaded first so wins */
+  if(streq(name, "key_ic"))
+    return "XY";
 
   return val;
 }
@@ -20,7 +23,7 @@ int main(int argc, char *argv[])
   TermKey    *tk;
   TermKeyKey  key;
 
-  plan_tests(3);
+  plan_tests(6);
 
   /* There was never a VT750. We've just made this string up.
    * This test ensures that the hooked function can invent TI strings for new
@@ -37,6 +40,14 @@ int main(int argc, char *argv[])
   is_int(key.type,     TERMKEY_TYPE_KEYSYM,   "key.type after X");
   is_int(key.code.sym, TERMKEY_SYM_BACKSPACE, "key.code.sym after X");
 
+  termkey_push_bytes(tk, "XY", 2);
+
+  is_int(termkey_getkey(tk, &key), TERMKEY_RES_KEY, "getkey yields RES_KEY after XY");
+  is_int(key.code.sym, TERMKEY_SYM_BACKSPACE, "key.code.sym after XY");
+
+  termkey_getkey(tk, &key);
+  is_int(key.code.codepoint, 'Y', "key.code.codepoint after XY is the Y");
+
   termkey_destroy(tk);
 
   return exit_status();
@@ -0,0 +1,77 @@
+#include "../termkey.h"
+#include "taplib.h"
+
+#include <string.h>
+
+#define streq(a,b) (!strcmp(a,b))
+
+static const char *home_is_csi1(const char *name, const char *val, void *_)
+{
+  if(streq(name, "key_home"))
+    return "\x1b[1~";
+
+  return val;
+}
+
+int main(int argc, char *argv[])
+{
+  TermKey    *tk;
+  TermKeyKey  key;
+
+  plan_tests(20);
+
+  /* As in 40ti-override, the hook invents strings for a made-up terminal */
+  tk = termkey_new_abstract("vt750", TERMKEY_FLAG_NOSTART|TERMKEY_FLAG_MERGEKEYS);
+  termkey_hook_terminfo_getstr(tk, &home_is_csi1, NULL);
+  termkey_start(tk);
+
+  termkey_push_bytes(tk, "\x1b[A", 3);
+
+  is_int(termkey_getkey(tk, &key), TERMKEY_RES_KEY, "getkey yields RES_KEY for CSI A");
+  is_int(key.type,     TERMKEY_TYPE_KEYSYM, "key.type for CSI A");
+  is_int(key.code.sym, TERMKEY_SYM_UP,      "key.code.sym for CSI A");
+
+  termkey_push_bytes(tk, "\x1bOZ", 3);
+
+  is_int(termkey_getkey(tk, &key), TERMKEY_RES_KEY, "getkey yields RES_KEY for SS3 Z");
+  is_int(key.code.sym,  TERMKEY_SYM_TAB,      "key.code.sym for SS3 Z");
+  is_int(key.modifiers, TERMKEY_KEYMOD_SHIFT, "key.modifiers for SS3 Z");
+
+  termkey_push_bytes(tk, "\x1b[2~", 4);
+
+  is_int(termkey_getkey(tk, &key), TERMKEY_RES_KEY, "getkey yields RES_KEY for CSI 2~");
+  is_int(key.code.sym, TERMKEY_SYM_INSERT, "key.code.sym for CSI 2~");
+
+  termkey_push_bytes(tk, "\x1b[1~", 4);
+
+  is_int(termkey_getkey(tk, &key), TERMKEY_RES_KEY, "getkey yields RES_KEY for CSI 1~");
+  is_int(key.code.sym, TERMKEY_SYM_HOME, "key.code.sym for CSI 1~ is terminfo's");
+
+  termkey_push_bytes(tk, "\x1b[2", 3);
+
+  is_int(termkey_getkey(tk, &key), TERMKEY_RES_AGAIN, "getkey yields RES_AGAIN for partial CSI 2~");
+
+  termkey_push_bytes(tk, "4~", 2);
+
+  is_int(termkey_getkey(tk, &key), TERMKEY_RES_KEY, "getkey yields RES_KEY for CSI 24~");
+  is_int(key.type,        TERMKEY_TYPE_FUNCTION, "key.type for CSI 24~");
+  is_int(key.code.number, 12,                    "key.code.number for CSI 24~");
+
+  /* Modified keys aren't in the trie; the CSI driver still takes them */
+  termkey_push_bytes(tk, "\x1b[1;5A", 6);
+
+  is_int(termkey_getkey(tk, &key), TERMKEY_RES_KEY, "getkey yields RES_KEY for CSI 1;5A");
+  is_int(key.code.sym,  TERMKEY_SYM_UP,      "key.code.sym for CSI 1;5A");
+  is_int(key.modifiers, TERMKEY_KEYMOD_CTRL, "key.modifiers for CSI 1;5A");
+
+  termkey_push_bytes(tk, "\x1bOp", 3);
+
+  is_int(termkey_getkey(tk, &key), TERMKEY_RES_KEY, "getkey yields RES_KEY for SS3 p");
+  is_int(key.code.sym, TERMKEY_SYM_KP0, "key.code.sym for SS3 p");
+
+  is_int(termkey_getkey(tk, &key), TERMKEY_RES_NONE, "getkey yields RES_NONE when empty");
+
+  termkey_destroy(tk);
+
+  return exit_status();
+}
@@ -0,0 +1,59 @@
+#include "../termkey.h"
+#include "taplib.h"
+
+#include <string.h>
+
+#define streq(a,b) (!strcmp(a,b))
+
+static const char *backspace_is_data(const char *name, const char *val, void *data)
+{
+  if(streq(name, "key_backspace"))
+    return data;
+
+  return val;
+}
+
+static TermKey *new_vt750(char *backspace)
+{
+  TermKey *tk = termkey_new_abstract("vt750", TERMKEY_FLAG_NOSTART);
+  termkey_hook_terminfo_getstr(tk, &backspace_is_data, backspace);
+  termkey_start(tk);
+  return tk;
+}
+
+int main(int argc, char *argv[])
+{
+  TermKey    *tk1, *tk2, *tk3;
+  TermKeyKey  key;
+
+  plan_tests(8);
+
+  /* The first two share their keys; the third has a different hook so must
+   * not */
+  tk1 = new_vt750("X");
+  tk2 = new_vt750("X");
+  tk3 = new_vt750("Z");
+
+  termkey_push_bytes(tk1, "X", 1);
+  is_int(termkey_getkey(tk1, &key), TERMKEY_RES_KEY, "getkey yields RES_KEY after X on first");
+  is_int(key.code.sym, TERMKEY_SYM_BACKSPACE, "key.code.sym after X on first");
+
+  termkey_destroy(tk1);
+
+  termkey_push_bytes(tk2, "X", 1);
+  is_int(termkey_getkey(tk2, &key), TERMKEY_RES_KEY, "getkey yields RES_KEY after X on second");
+  is_int(key.code.sym, TERMKEY_SYM_BACKSPACE, "key.code.sym after X on second, first destroyed");
+
+  termkey_push_bytes(tk3, "X", 1);
+  is_int(termkey_getkey(tk3, &key), TERMKEY_RES_KEY, "getkey yields RES_KEY after X on third");
+  is_int(key.type, TERMKEY_TYPE_UNICODE, "key.type after X on third");
+
+  termkey_push_bytes(tk3, "Z", 1);
+  is_int(termkey_getkey(tk3, &key), TERMKEY_RES_KEY, "getkey yields RES_KEY after Z on third");
+  is_int(key.code.sym, TERMKEY_SYM_BACKSPACE, "key.code.sym after Z on third");
+
+  termkey_destroy(tk2);
+  termkey_destroy(tk3);
+
+  return exit_status();
+}
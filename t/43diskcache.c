@@ -0,0 +1,69 @@
+#define _XOPEN_SOURCE 700
+
+#include "../termkey.h"
+#include "taplib.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+static void check_home(const char *when)
+{
+  TermKey    *tk;
+  TermKeyKey  key;
+  char        name[64];
+
+  tk = termkey_new_abstract("xterm", TERMKEY_FLAG_DISKCACHE);
+
+  termkey_push_bytes(tk, "\x1bOH", 3);
+
+  snprintf(name, sizeof name, "getkey yields RES_KEY for Home %s", when);
+  is_int(termkey_getkey(tk, &key), TERMKEY_RES_KEY, name);
+
+  snprintf(name, sizeof name, "key.code.sym for Home %s", when);
+  is_int(key.code.sym, TERMKEY_SYM_HOME, name);
+
+  termkey_destroy(tk);
+}
+
+int main(int argc, char *argv[])
+{
+  char dir[] = "/tmp/termkey-cacheXXXXXX";
+  char path[128];
+  struct stat st;
+  FILE *f;
+
+  plan_tests(9);
+
+  if(!mkdtemp(dir)) {
+    perror("mkdtemp");
+    return 1;
+  }
+  setenv("XDG_CACHE_HOME", dir, 1);
+  snprintf(path, sizeof path, "%s/libtermkey/xterm-0.trie", dir);
+
+  check_home("loading terminfo");
+
+  ok(stat(path, &st) == 0 && st.st_size > 0, "cache file written");
+
+  check_home("from the cache");
+
+  /* A damaged cache file is ignored and replaced */
+  f = fopen(path, "r+");
+  fseek(f, 64, SEEK_SET);
+  fwrite("\xff\xff\xff\xff\xff\xff\xff\xff", 8, 1, f);
+  fclose(f);
+
+  check_home("with a damaged cache");
+
+  check_home("from the rewritten cache");
+
+  unlink(path);
+  snprintf(path, sizeof path, "%s/libtermkey", dir);
+  rmdir(path);
+  rmdir(dir);
+
+  return exit_status();
+}
@@ -0,0 +1,189 @@
+#define _XOPEN_SOURCE 700
+
+#include "../termkey.h"
+#include "taplib.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define streq(a,b) (!strcmp(a,b))
+
+/* String capability indexes in the compiled format */
+#define KEY_DC        59
+#define KEY_F0        65
+#define KEY_F9        75
+#define KEYPAD_XMIT   89
+
+#define NSTRINGS      90
+
+static const char *dc_value, *sdc_value;
+
+static const char *record_dc(const char *name, const char *val, void *_)
+{
+  if(streq(name, "key_dc"))
+    dc_value = val;
+  if(streq(name, "key_sdc"))
+    sdc_value = val;
+
+  return val;
+}
+
+static void put16(FILE *f, int v)
+{
+  fputc(v & 0xff, f);
+  fputc((v >> 8) & 0xff, f);
+}
+
+/* Writes a small compiled terminfo entry, with 16-bit numbers if numsize is
+ * 2 or 32-bit ones if it is 4
+ */
+static void write_terminfo(const char *path, int numsize)
+{
+  static const char names[] = "tktest|libtermkey test";
+  /* "Zn" is Fn, and "Z0" F0 and F10, in capability order: F0, F1, F10, F2... */
+  static const char strtab[] = "Z0\0Z1\0Z0\0Z2\0Z3\0Z4\0Z5\0Z6\0Z7\0Z8\0Z9\0\x1b[?1h\x1b=";
+  FILE *f = fopen(path, "wb");
+
+  put16(f, numsize == 4 ? 01036 : 0432);
+  put16(f, sizeof names);
+  put16(f, 2);                 /* booleans, so the numbers need padding */
+  put16(f, 2);                 /* numbers */
+  put16(f, NSTRINGS);
+  put16(f, sizeof strtab);
+
+  fwrite(names, sizeof names, 1, f);
+  fputc(1, f);
+  fputc(0, f);
+  if((sizeof names + 2) & 1)
+    fputc(0, f);
+
+  for(int i = 0; i < 2 * numsize; i++)
+    fputc(0xff, f);
+
+  for(int i = 0; i < NSTRINGS; i++)
+    if(i >= KEY_F0 && i <= KEY_F9)
+      put16(f, (i - KEY_F0) * 3);
+    else if(i == KEYPAD_XMIT)
+      put16(f, (KEY_F9 - KEY_F0 + 1) * 3);
+    else if(i == KEY_DC)
+      put16(f, 0xfffe); /* cancelled */
+    else
+      put16(f, 0xffff); /* absent */
+
+  fwrite(strtab, sizeof strtab, 1, f);
+  fclose(f);
+}
+
+static void check_terminfo(const char *term, const char *format)
+{
+  TermKey    *tk;
+  TermKeyKey  key;
+  char        name[80];
+
+  tk = termkey_new_abstract(term, TERMKEY_FLAG_NOSTART);
+  termkey_hook_terminfo_getstr(tk, &record_dc, NULL);
+  dc_value = sdc_value = "unset";
+  termkey_start(tk);
+
+  termkey_push_bytes(tk, "Z1", 2);
+
+  snprintf(name, sizeof name, "getkey yields RES_KEY for F1 from %s", format);
+  is_int(termkey_getkey(tk, &key), TERMKEY_RES_KEY, name);
+
+  snprintf(name, sizeof name, "key.code.number for F1 from %s", format);
+  is_int(key.code.number, 1, name);
+
+  termkey_push_bytes(tk, "Z0", 2);
+
+  snprintf(name, sizeof name, "getkey yields RES_KEY for F10 from %s", format);
+  is_int(termkey_getkey(tk, &key), TERMKEY_RES_KEY, name);
+
+  snprintf(name, sizeof name, "key.code.number for F10 from %s", format);
+  is_int(key.code.number, 10, name);
+
+  snprintf(name, sizeof name, "cancelled key_dc is NULL from %s", format);
+  ok(dc_value == NULL, name);
+
+  /* key_sdc is only asked for when key_dc exists */
+  snprintf(name, sizeof name, "key_sdc not asked for from %s", format);
+  ok(sdc_value && streq(sdc_value, "unset"), name);
+
+  termkey_destroy(tk);
+}
+
+int main(int argc, char *argv[])
+{
+  char dir[] = "/tmp/termkey-terminfoXXXXXX";
+  char path[128];
+  char dirs[128];
+  TermKey *tk;
+  TermKeyKey key;
+
+  plan_tests(17);
+
+  if(!mkdtemp(dir)) {
+    perror("mkdtemp");
+    return 1;
+  }
+  setenv("TERMINFO", dir, 1);
+
+  snprintf(path, sizeof path, "%s/t", dir);
+  mkdir(path, 0700);
+
+  snprintf(path, sizeof path, "%s/t/tktest-16", dir);
+  write_terminfo(path, 2);
+  check_terminfo("tktest-16", "legacy format");
+  unlink(path);
+
+  snprintf(path, sizeof path, "%s/t/tktest-32", dir);
+  write_terminfo(path, 4);
+  check_terminfo("tktest-32", "extended-number format");
+  unlink(path);
+
+  /* The user's terminfo wins over keys built into the library */
+  snprintf(path, sizeof path, "%s/x", dir);
+  mkdir(path, 0700);
+
+  snprintf(path, sizeof path, "%s/x/xterm-256color", dir);
+  write_terminfo(path, 2);
+
+  tk = termkey_new_abstract("xterm-256color", 0);
+  termkey_push_bytes(tk, "Z1", 2);
+
+  is_int(termkey_getkey(tk, &key), TERMKEY_RES_KEY, "getkey yields RES_KEY for F1 from $TERMINFO over builtin");
+  is_int(key.code.number, 1, "key.code.number for F1 from $TERMINFO over builtin");
+
+  termkey_destroy(tk);
+
+  /* An empty $TERMINFO_DIRS entry is the system directories, searched first */
+  unsetenv("TERMINFO");
+  snprintf(dirs, sizeof dirs, ":%s", dir);
+  setenv("TERMINFO_DIRS", dirs, 1);
+
+  tk = termkey_new_abstract("xterm-256color", 0);
+  termkey_push_bytes(tk, "Z1", 2);
+
+  is_int(termkey_getkey(tk, &key), TERMKEY_RES_KEY, "getkey yields RES_KEY for Z from system terminfo");
+  is_int(key.type, TERMKEY_TYPE_UNICODE, "key.type for Z from system terminfo");
+
+  termkey_destroy(tk);
+  unsetenv("TERMINFO_DIRS");
+  unlink(path);
+
+  snprintf(path, sizeof path, "%s/x", dir);
+  rmdir(path);
+
+  /* Unknown terminals still work, just without terminfo keys */
+  tk = termkey_new_abstract("tktest-missing", 0);
+  ok(!!tk, "termkey_new_abstract for unknown terminal");
+  termkey_destroy(tk);
+
+  snprintf(path, sizeof path, "%s/t", dir);
+  rmdir(path);
+  rmdir(dir);
+
+  return exit_status();
+}
@@ -0,0 +1,79 @@
+#include "../termkey.h"
+#include "taplib.h"
+
+#include <string.h>
+
+#define streq(a,b) (!strcmp(a,b))
+
+static int getstr_calls;
+
+static const char *linux_fkeys(const char *name, const char *val, void *_)
+{
+  getstr_calls++;
+
+  if(streq(name, "key_f1"))
+    return "\x1b[[A";
+  if(streq(name, "key_f2"))
+    return "\x1b[[B";
+  if(streq(name, "key_f3"))
+    return "\x1bOz";
+
+  return val;
+}
+
+int main(int argc, char *argv[])
+{
+  TermKey    *tk;
+  TermKeyKey  key;
+
+  plan_tests(15);
+
+  tk = termkey_new_abstract("vt750", TERMKEY_FLAG_NOSTART|TERMKEY_FLAG_LAZYTERMINFO);
+  termkey_hook_terminfo_getstr(tk, &linux_fkeys, NULL);
+  termkey_start(tk);
+
+  termkey_push_bytes(tk, "\x1b[A", 3);
+
+  is_int(termkey_getkey(tk, &key), TERMKEY_RES_KEY, "getkey yields RES_KEY for CSI A");
+  is_int(key.code.sym, TERMKEY_SYM_UP, "key.code.sym for CSI A");
+
+  ok(getstr_calls == 0, "terminfo not loaded for CSI A");
+
+  termkey_push_bytes(tk, "\x1b" "a", 2);
+
+  is_int(termkey_getkey(tk, &key), TERMKEY_RES_KEY, "getkey yields RES_KEY for Alt-a");
+  is_int(key.code.codepoint, 'a',              "key.code.codepoint for Alt-a");
+  is_int(key.modifiers,      TERMKEY_KEYMOD_ALT, "key.modifiers for Alt-a");
+
+  ok(getstr_calls == 0, "terminfo not loaded for Alt-a");
+
+  /* The CSI driver makes this an unknown CSI; terminfo knows it */
+  termkey_push_bytes(tk, "\x1b[[A", 4);
+
+  is_int(termkey_getkey(tk, &key), TERMKEY_RES_KEY, "getkey yields RES_KEY for CSI [A");
+  is_int(key.type,        TERMKEY_TYPE_FUNCTION, "key.type for CSI [A");
+  is_int(key.code.number, 1,                     "key.code.number for CSI [A");
+
+  ok(getstr_calls > 0, "terminfo loaded for CSI [A");
+
+  termkey_push_bytes(tk, "\x1b[[B", 4);
+
+  is_int(termkey_getkey(tk, &key), TERMKEY_RES_KEY, "getkey yields RES_KEY for CSI [B");
+  is_int(key.code.number, 2, "key.code.number for CSI [B");
+
+  termkey_destroy(tk);
+
+  /* An SS3 the CSI driver doesn't know also loads it */
+  tk = termkey_new_abstract("vt750", TERMKEY_FLAG_NOSTART|TERMKEY_FLAG_LAZYTERMINFO);
+  termkey_hook_terminfo_getstr(tk, &linux_fkeys, NULL);
+  termkey_start(tk);
+
+  termkey_push_bytes(tk, "\x1bOz", 3);
+
+  is_int(termkey_getkey(tk, &key), TERMKEY_RES_KEY, "getkey yields RES_KEY for SS3 z");
+  is_int(key.code.number, 3, "key.code.number for SS3 z");
+
+  termkey_destroy(tk);
+
+  return exit_status();
+}
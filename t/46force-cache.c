@@ -0,0 +1,53 @@
+#include "../termkey.h"
+#include "taplib.h"
+
+int main(int argc, char *argv[])
+{
+  TermKey    *tk;
+  TermKeyKey  key;
+
+  plan_tests(17);
+
+  tk = termkey_new_abstract("vt100", 0);
+
+  termkey_push_bytes(tk, "\x1b", 1);
+
+  is_int(termkey_getkey(tk, &key), TERMKEY_RES_AGAIN, "getkey yields RES_AGAIN for Escape");
+  is_int(key.type,     TERMKEY_TYPE_KEYSYM, "provisional key.type for Escape");
+  is_int(key.code.sym, TERMKEY_SYM_ESCAPE,  "provisional key.code.sym for Escape");
+
+  key.code.sym = TERMKEY_SYM_NONE;
+
+  is_int(termkey_getkey(tk, &key), TERMKEY_RES_AGAIN, "getkey yields RES_AGAIN for Escape again");
+  is_int(key.code.sym, TERMKEY_SYM_ESCAPE, "provisional key.code.sym for Escape again");
+
+  is_int(termkey_getkey_force(tk, &key), TERMKEY_RES_KEY, "getkey_force yields RES_KEY for Escape");
+  is_int(key.code.sym, TERMKEY_SYM_ESCAPE, "key.code.sym for Escape");
+
+  is_int(termkey_getkey(tk, &key), TERMKEY_RES_NONE, "getkey yields RES_NONE after Escape");
+
+  /* More bytes make the provisional answer stale */
+  termkey_push_bytes(tk, "\x1b", 1);
+
+  is_int(termkey_getkey(tk, &key), TERMKEY_RES_AGAIN, "getkey yields RES_AGAIN for partial Up");
+
+  termkey_push_bytes(tk, "[A", 2);
+
+  is_int(termkey_getkey(tk, &key), TERMKEY_RES_KEY, "getkey yields RES_KEY for Up");
+  is_int(key.code.sym, TERMKEY_SYM_UP, "key.code.sym for Up");
+
+  termkey_push_bytes(tk, "\x1b[", 2);
+
+  is_int(termkey_getkey(tk, &key), TERMKEY_RES_AGAIN, "getkey yields RES_AGAIN for partial CSI");
+  is_int(key.code.codepoint, '[',                "provisional key.code.codepoint for partial CSI");
+  is_int(key.modifiers,      TERMKEY_KEYMOD_ALT, "provisional key.modifiers for partial CSI");
+
+  is_int(termkey_getkey_force(tk, &key), TERMKEY_RES_KEY, "getkey_force yields RES_KEY for partial CSI");
+  is_int(key.code.codepoint, '[', "key.code.codepoint for partial CSI");
+
+  is_int(termkey_getkey(tk, &key), TERMKEY_RES_NONE, "getkey yields RES_NONE after partial CSI");
+
+  termkey_destroy(tk);
+
+  return exit_status();
+}
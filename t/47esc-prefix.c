@@ -0,0 +1,70 @@
+#include "../termkey.h"
+#include "taplib.h"
+
+#include <string.h>
+
+#define NESCS 100000
+
+int main(int argc, char *argv[])
+{
+  TermKey    *tk;
+  TermKeyKey  key;
+  char        escs[1024];
+  int         pushed, keys, all_alt_escape;
+
+  plan_tests(18);
+
+  tk = termkey_new_abstract("vt100", 0);
+
+  termkey_push_bytes(tk, "\x1b\x1b[A", 4);
+
+  is_int(termkey_getkey(tk, &key), TERMKEY_RES_KEY, "getkey yields RES_KEY for Alt-Up");
+  is_int(key.code.sym,  TERMKEY_SYM_UP,      "key.code.sym for Alt-Up");
+  is_int(key.modifiers, TERMKEY_KEYMOD_ALT,  "key.modifiers for Alt-Up");
+
+  is_int(termkey_getkey(tk, &key), TERMKEY_RES_NONE, "getkey yields RES_NONE after Alt-Up");
+
+  termkey_push_bytes(tk, "\x1b\x1b", 2);
+
+  is_int(termkey_getkey(tk, &key), TERMKEY_RES_AGAIN, "getkey yields RES_AGAIN for Esc Esc");
+
+  is_int(termkey_getkey_force(tk, &key), TERMKEY_RES_KEY, "getkey_force yields RES_KEY for Alt-Escape");
+  is_int(key.code.sym,  TERMKEY_SYM_ESCAPE, "key.code.sym for Alt-Escape");
+  is_int(key.modifiers, TERMKEY_KEYMOD_ALT, "key.modifiers for Alt-Escape");
+
+  /* Only one Escape is a prefix; the next is a key of its own */
+  termkey_push_bytes(tk, "\x1b\x1b\x1b" "a", 4);
+
+  is_int(termkey_getkey(tk, &key), TERMKEY_RES_KEY, "getkey yields RES_KEY for Esc Esc Esc a");
+  is_int(key.code.sym,  TERMKEY_SYM_ESCAPE, "key.code.sym for Esc Esc Esc a");
+  is_int(key.modifiers, TERMKEY_KEYMOD_ALT, "key.modifiers for Esc Esc Esc a");
+
+  is_int(termkey_getkey(tk, &key), TERMKEY_RES_KEY, "getkey yields RES_KEY for Esc a");
+  is_int(key.code.codepoint, 'a',              "key.code.codepoint for Esc a");
+  is_int(key.modifiers,      TERMKEY_KEYMOD_ALT, "key.modifiers for Esc a");
+
+  /* A flood of Escapes decodes a pair at a time without recursing */
+  memset(escs, 0x1b, sizeof escs);
+  pushed = keys = 0;
+  all_alt_escape = 1;
+  while(pushed < NESCS) {
+    pushed += termkey_push_bytes(tk, escs, sizeof escs < NESCS - pushed ? sizeof escs : NESCS - pushed);
+
+    while(termkey_getkey(tk, &key) == TERMKEY_RES_KEY) {
+      keys++;
+      if(key.code.sym != TERMKEY_SYM_ESCAPE || key.modifiers != TERMKEY_KEYMOD_ALT)
+        all_alt_escape = 0;
+    }
+  }
+
+  /* The last pair might yet start Alt-Up */
+  is_int(keys, NESCS / 2 - 1, "Escape flood yields one key per pair");
+  ok(all_alt_escape, "Escape flood keys are all Alt-Escape");
+
+  is_int(termkey_getkey_force(tk, &key), TERMKEY_RES_KEY, "getkey_force yields RES_KEY for last pair");
+  is_int(termkey_getkey(tk, &key), TERMKEY_RES_NONE, "getkey yields RES_NONE after Escape flood");
+
+  termkey_destroy(tk);
+
+  return exit_status();
+}
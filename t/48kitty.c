@@ -0,0 +1,204 @@
+#define _XOPEN_SOURCE 700
+
+#include "../termkey.h"
+#include "taplib.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+/* Reads what the instance has written to the terminal */
+static const char *readall(int fd)
+{
+  static char buf[256];
+  ssize_t len = read(fd, buf, sizeof buf - 1);
+  buf[len > 0 ? len : 0] = 0;
+  return buf;
+}
+
+int main(int argc, char *argv[])
+{
+  TermKey    *tk;
+  TermKeyKey  key;
+  char        buffer[32];
+  int         fd[2];
+
+  plan_tests(67);
+
+  tk = termkey_new_abstract("vt100", 0);
+
+  termkey_push_bytes(tk, "\x1b[27u", 5);
+
+  is_int(termkey_getkey(tk, &key), TERMKEY_RES_KEY, "getkey yields RES_KEY for Escape");
+  is_int(key.type,      TERMKEY_TYPE_KEYSYM, "key.type for Escape");
+  is_int(key.code.sym,  TERMKEY_SYM_ESCAPE,  "key.code.sym for Escape");
+  is_int(key.modifiers, 0,                   "key.modifiers for Escape");
+  is_int(key.event,     TERMKEY_KEYEVENT_PRESS, "key.event for Escape");
+
+  termkey_push_bytes(tk, "\x1b[97;5u", 7);
+
+  is_int(termkey_getkey(tk, &key), TERMKEY_RES_KEY, "getkey yields RES_KEY for Ctrl-a");
+  is_int(key.code.codepoint, 'a',               "key.code.codepoint for Ctrl-a");
+  is_int(key.modifiers,      TERMKEY_KEYMOD_CTRL, "key.modifiers for Ctrl-a");
+
+  /* Event types */
+  termkey_push_bytes(tk, "\x1b[97;3:3u", 9);
+
+  is_int(termkey_getkey(tk, &key), TERMKEY_RES_KEY, "getkey yields RES_KEY for Alt-a release");
+  is_int(key.code.codepoint, 'a',                      "key.code.codepoint for Alt-a release");
+  is_int(key.modifiers,      TERMKEY_KEYMOD_ALT,       "key.modifiers for Alt-a release");
+  is_int(key.event,          TERMKEY_KEYEVENT_RELEASE, "key.event for Alt-a release");
+
+  termkey_push_bytes(tk, "b", 1);
+
+  is_int(termkey_getkey(tk, &key), TERMKEY_RES_KEY, "getkey yields RES_KEY for b");
+  is_int(key.event, TERMKEY_KEYEVENT_PRESS, "key.event for b");
+
+  termkey_push_bytes(tk, "\x1b[1;5:2A", 8);
+
+  is_int(termkey_getkey(tk, &key), TERMKEY_RES_KEY, "getkey yields RES_KEY for Ctrl-Up repeat");
+  is_int(key.code.sym,  TERMKEY_SYM_UP,          "key.code.sym for Ctrl-Up repeat");
+  is_int(key.modifiers, TERMKEY_KEYMOD_CTRL,     "key.modifiers for Ctrl-Up repeat");
+  is_int(key.event,     TERMKEY_KEYEVENT_REPEAT, "key.event for Ctrl-Up repeat");
+
+  /* Modifiers beyond the legacy three */
+  termkey_push_bytes(tk, "\x1b[97;9u", 7);
+
+  is_int(termkey_getkey(tk, &key), TERMKEY_RES_KEY, "getkey yields RES_KEY for Super-a");
+  is_int(key.modifiers, TERMKEY_KEYMOD_SUPER, "key.modifiers for Super-a");
+
+  termkey_strfkey(tk, buffer, sizeof buffer, &key, TERMKEY_FORMAT_LONGMOD);
+  is_str(buffer, "Super-a", "strfkey for Super-a");
+
+  termkey_strfkey(tk, buffer, sizeof buffer, &key, 0);
+  is_str(buffer, "D-a", "strfkey for Super-a abbreviated");
+
+  ok(!!termkey_strpkey(tk, "Hyper-Meta-x", &key, TERMKEY_FORMAT_LONGMOD), "strpkey parses Hyper-Meta-x");
+  is_int(key.modifiers, TERMKEY_KEYMOD_HYPER|TERMKEY_KEYMOD_META, "key.modifiers for Hyper-Meta-x");
+
+  /* Meta stays apart from Alt when Alt is named Meta */
+  termkey_push_bytes(tk, "\x1b[97;35u", 8);
+  termkey_getkey(tk, &key);
+
+  termkey_strfkey(tk, buffer, sizeof buffer, &key, TERMKEY_FORMAT_LONGMOD|TERMKEY_FORMAT_ALTISMETA);
+  is_str(buffer, "TrueMeta-Meta-a", "strfkey for Meta-Alt-a with ALTISMETA");
+
+  /* Every new modifier, with Alt, in every form of modifier name survives
+   * a round trip */
+  for(int f = 0; f < 8; f++) {
+    TermKeyFormat format = ((f & 1) ? TERMKEY_FORMAT_LONGMOD : 0) |
+                           ((f & 2) ? TERMKEY_FORMAT_ALTISMETA : 0) |
+                           ((f & 4) ? TERMKEY_FORMAT_LOWERMOD : 0);
+    TermKeyKey parsed;
+    int roundtrip = 1;
+
+    for(int mod = TERMKEY_KEYMOD_SUPER; mod <= TERMKEY_KEYMOD_META; mod <<= 1) {
+      termkey_strpkey(tk, "x", &key, 0);
+      key.modifiers = mod|TERMKEY_KEYMOD_ALT;
+
+      termkey_strfkey(tk, buffer, sizeof buffer, &key, format);
+      if(!termkey_strpkey(tk, buffer, &parsed, format) || parsed.modifiers != key.modifiers)
+        roundtrip = 0;
+    }
+
+    snprintf(buffer, sizeof buffer, "round trip in format %d", f);
+    ok(roundtrip, buffer);
+  }
+
+  /* Lock states aren't modifiers unless asked for */
+  termkey_push_bytes(tk, "\x1b[97;65u", 8);
+
+  is_int(termkey_getkey(tk, &key), TERMKEY_RES_KEY, "getkey yields RES_KEY for a with Caps Lock");
+  is_int(key.modifiers, 0, "key.modifiers for a with Caps Lock");
+
+  termkey_push_bytes(tk, "\x1b[1;129A", 8);
+
+  is_int(termkey_getkey(tk, &key), TERMKEY_RES_KEY, "getkey yields RES_KEY for Up with Num Lock");
+  is_int(key.modifiers, 0, "key.modifiers for Up with Num Lock");
+
+  termkey_set_canonflags(tk, termkey_get_canonflags(tk) | TERMKEY_CANON_LOCKMODS);
+
+  termkey_push_bytes(tk, "\x1b[1;129A", 8);
+
+  is_int(termkey_getkey(tk, &key), TERMKEY_RES_KEY, "getkey yields RES_KEY for Up with Num Lock and CANON_LOCKMODS");
+  is_int(key.modifiers, TERMKEY_KEYMOD_NUMLOCK, "key.modifiers for Up with Num Lock and CANON_LOCKMODS");
+
+  termkey_set_canonflags(tk, termkey_get_canonflags(tk) & ~TERMKEY_CANON_LOCKMODS);
+
+  /* Shifted keys, as an alternate key or as text */
+  termkey_push_bytes(tk, "\x1b[97:65;2u", 10);
+
+  is_int(termkey_getkey(tk, &key), TERMKEY_RES_KEY, "getkey yields RES_KEY for shifted alternate");
+  is_int(key.code.codepoint, 'A', "key.code.codepoint for shifted alternate");
+  is_int(key.modifiers,      0,   "key.modifiers for shifted alternate");
+
+  termkey_push_bytes(tk, "\x1b[97;2;65u", 10);
+
+  is_int(termkey_getkey(tk, &key), TERMKEY_RES_KEY, "getkey yields RES_KEY for shifted text");
+  is_int(key.code.codepoint, 'A', "key.code.codepoint for shifted text");
+  is_int(key.modifiers,      0,   "key.modifiers for shifted text");
+
+  /* Text is used whether or not Shift is held */
+  termkey_push_bytes(tk, "\x1b[97;65;65u", 11);
+
+  is_int(termkey_getkey(tk, &key), TERMKEY_RES_KEY, "getkey yields RES_KEY for text with Caps Lock");
+  is_int(key.code.codepoint, 'A', "key.code.codepoint for text with Caps Lock");
+  is_int(key.modifiers,      0,   "key.modifiers for text with Caps Lock");
+
+  termkey_push_bytes(tk, "\x1b[113;1;97u", 11);
+
+  is_int(termkey_getkey(tk, &key), TERMKEY_RES_KEY, "getkey yields RES_KEY for text without Shift");
+  is_int(key.code.codepoint, 'a', "key.code.codepoint for text without Shift");
+  is_int(key.modifiers,      0,   "key.modifiers for text without Shift");
+
+  /* Functional keys */
+  termkey_push_bytes(tk, "\x1b[57399u", 8);
+
+  is_int(termkey_getkey(tk, &key), TERMKEY_RES_KEY, "getkey yields RES_KEY for KP0");
+  is_int(key.type,     TERMKEY_TYPE_KEYSYM, "key.type for KP0");
+  is_int(key.code.sym, TERMKEY_SYM_KP0,     "key.code.sym for KP0");
+
+  termkey_push_bytes(tk, "\x1b[57376;5u", 10);
+
+  is_int(termkey_getkey(tk, &key), TERMKEY_RES_KEY, "getkey yields RES_KEY for Ctrl-F13");
+  is_int(key.type,        TERMKEY_TYPE_FUNCTION, "key.type for Ctrl-F13");
+  is_int(key.code.number, 13,                    "key.code.number for Ctrl-F13");
+  is_int(key.modifiers,   TERMKEY_KEYMOD_CTRL,   "key.modifiers for Ctrl-F13");
+
+  termkey_push_bytes(tk, "\x1b[57441u", 8);
+
+  is_int(termkey_getkey(tk, &key), TERMKEY_RES_KEY, "getkey yields RES_KEY for Left Shift");
+  is_int(key.type, TERMKEY_TYPE_UNKNOWN_CSI, "key.type for Left Shift");
+
+  /* Reply to CSI ? u */
+  termkey_push_bytes(tk, "\x1b[?3u", 5);
+
+  is_int(termkey_getkey(tk, &key), TERMKEY_RES_KEY, "getkey yields RES_KEY for flags report");
+  is_int(key.type,        TERMKEY_TYPE_KITTYFLAGS, "key.type for flags report");
+  is_int(key.code.number, 3,                       "key.code.number for flags report");
+
+  termkey_destroy(tk);
+
+  /* The flags are pushed on start and popped on stop */
+  socketpair(AF_UNIX, SOCK_STREAM, 0, fd);
+
+  tk = termkey_new(fd[0], TERMKEY_FLAG_NOTERMIOS|TERMKEY_FLAG_NOSTART);
+  termkey_set_kittyflags(tk, TERMKEY_KITTY_DISAMBIGUATE|TERMKEY_KITTY_EVENTS);
+  is_int(termkey_get_kittyflags(tk), 3, "get_kittyflags after set");
+
+  termkey_start(tk);
+  ok(!!strstr(readall(fd[1]), "\x1b[>3u"), "start pushes kitty flags");
+
+  termkey_set_kittyflags(tk, TERMKEY_KITTY_DISAMBIGUATE);
+  is_str(readall(fd[1]), "\x1b[<u\x1b[>1u", "set_kittyflags while started replaces them");
+
+  termkey_stop(tk);
+  ok(!!strstr(readall(fd[1]), "\x1b[<u"), "stop pops kitty flags");
+
+  termkey_destroy(tk);
+  close(fd[0]);
+  close(fd[1]);
+
+  return exit_status();
+}
@@ -10,6 +10,7 @@
 #include "termkey.h"
 
 #include <stdint.h>
+#include <string.h>
 #ifdef HAVE_TERMIOS
 # include <termios.h>
 #endif
@@ -27,6 +28,18 @@ struct TermKeyDriver
   int            (*start_driver)(TermKey *tk, void *info);
   int            (*stop_driver)(TermKey *tk, void *info);
   TermKeyResult (*peekkey)(TermKey *tk, void *info, TermKeyKey *key, int force, size_t *nbytes);
+  /* Optional; whether any key this driver recognises might begin with byte.
+   * Asked once the driver is started. Without it, any byte might */
+  int            (*may_start)(TermKey *tk, void *info, unsigned char byte);
+  /* Optional; for a driver that put off loading its keys when started. Called
+   * once an escape sequence goes unrecognised; returns true if it has loaded
+   * keys, so the drivers should be asked again */
+  int            (*load_deferred)(TermKey *tk, void *info);
+  /* Optional; for a driver that sets driver_pending. Decodes only a key that
+   * continues what the driver has in progress, such as the rest of a paste,
+   * and returns TERMKEY_RES_NONE for anything else. Asked before any driver's
+   * peekkey, so no other driver takes those bytes as keys of its own */
+  TermKeyResult (*peekkey_pending)(TermKey *tk, void *info, TermKeyKey *key, int force, size_t *nbytes);
 };
 
 struct keyinfo {
@@ -47,12 +60,30 @@ struct TermKey {
   int    fd;
   int    flags;
   int    canonflags;
-  unsigned char *buffer;
+  int    kittyflags; // Kitty keyboard protocol enhancements to push on start
+  unsigned char *buffer; // A ring; the valid entries may wrap around the end
   size_t buffstart; // First offset in buffer
   size_t buffcount; // NUMBER of entires valid in buffer
   size_t buffsize; // Total malloc'ed size
-  size_t hightide; /* Position beyond buffstart at which peekkey() should next start
-                    * normally 0, but see also termkey_interpret_csi */
+  size_t buffbase; // Size requested by the user; the adaptive buffer returns here
+  size_t bufflimit; // Adaptive buffer may grow up to this size; 0 if fixed
+  size_t buffpeak; // Greatest buffcount since the buffer was last drained
+  size_t buffhighwater; // Greatest buffcount ever
+  int    buffquiet; // Drains in a row whose peak would fit a smaller adaptive buffer
+  size_t buffquietpeak; // Greatest buffpeak over those drains
+  size_t buffpos; // Offset of buffstart within the whole input stream
+  size_t readbudget; // Most bytes one TERMKEY_FLAG_DRAIN read may take; 0 for no limit
+
+  /* The force-mode decode of a partial key, kept until more bytes arrive or
+   * some are eaten. Only valid if it matches buffpos, buffcount, flags and
+   * canonflags */
+  struct {
+    char        valid;
+    size_t      buffpos, buffcount;
+    int         flags, canonflags;
+    size_t      nbytes;
+    TermKeyKey  key;
+  } forced;
 
 #ifdef HAVE_TERMIOS
   struct termios restore_termios;
@@ -66,6 +97,7 @@ struct TermKey {
 
   char   is_closed;
   char   is_started;
+  char   fd_nonblocking; // As found by termkey_start() or termkey_set_flags()
 
   int  nkeynames;
   const char **keynames;
@@ -73,6 +105,13 @@ struct TermKey {
   // There are 32 C0 codes
   struct keyinfo c0[32];
 
+  /* For each first byte, a bitmask by list position of the drivers that might
+   * begin a key there; see DRIVER_BIT() */
+  unsigned char driverbytes[256];
+  char driver_claims_text; // Some of those are bytes of printable text
+  char driver_pending; // Set by a driver whose next key may begin with any byte
+  char driver_deferred; // Set by a driver with load_deferred still to be called
+
   struct TermKeyDriverNode *drivers;
 
   // Now some "protected" methods for the driver to call but which we don't
@@ -84,6 +123,92 @@ struct TermKey {
   } method;
 };
 
+/* Accessors for the input buffer. Offsets are relative to buffstart, and
+ * wrap around the end of the ring as required
+ */
+static inline unsigned char termkey_buffer_at(const TermKey *tk, size_t i)
+{
+  size_t pos = tk->buffstart + i;
+  if(pos >= tk->buffsize)
+    pos -= tk->buffsize;
+
+  return tk->buffer[pos];
+}
+
+#define CHARAT(i) termkey_buffer_at(tk, (i))
+
+static inline void termkey_buffer_copy(const TermKey *tk, size_t offset, size_t len, unsigned char *dst)
+{
+  size_t pos = tk->buffstart + offset;
+  if(pos >= tk->buffsize)
+    pos -= tk->buffsize;
+
+  size_t first = tk->buffsize - pos;
+  if(first > len)
+    first = len;
+
+  memcpy(dst, tk->buffer + pos, first);
+  memcpy(dst + first, tk->buffer, len - first);
+}
+
+/* Finds the first occurrence of the len bytes at str in the buffer, starting
+ * at offset from. Returns its offset, or buffcount if it isn't there
+ */
+static inline size_t termkey_buffer_find(const TermKey *tk, size_t from, const char *str, size_t len)
+{
+  while(from + len <= tk->buffcount) {
+    size_t pos = tk->buffstart + from;
+    if(pos >= tk->buffsize)
+      pos -= tk->buffsize;
+
+    size_t seg = tk->buffsize - pos;
+    if(seg > tk->buffcount - from)
+      seg = tk->buffcount - from;
+
+    const unsigned char *hit = memchr(tk->buffer + pos, str[0], seg);
+    if(!hit) {
+      from += seg;
+      continue;
+    }
+
+    from += hit - (tk->buffer + pos);
+
+    size_t i;
+    for(i = 1; i < len && from + i < tk->buffcount; i++)
+      if(termkey_buffer_at(tk, from + i) != (unsigned char)str[i])
+        break;
+
+    if(i == len)
+      return from;
+
+    from++;
+  }
+
+  return tk->buffcount;
+}
+
+/* Temporarily step over some leading bytes so that another parser can look
+ * at those after them, such as after a mouse or Alt prefix. Every skip must
+ * be paired with an unskip of the same count
+ */
+static inline void termkey_buffer_skip(TermKey *tk, size_t count)
+{
+  tk->buffpos += count;
+  tk->buffstart += count;
+  if(tk->buffstart >= tk->buffsize)
+    tk->buffstart -= tk->buffsize;
+  tk->buffcount -= count;
+}
+
+static inline void termkey_buffer_unskip(TermKey *tk, size_t count)
+{
+  if(tk->buffstart < count)
+    tk->buffstart += tk->buffsize;
+  tk->buffpos -= count;
+  tk->buffstart -= count;
+  tk->buffcount += count;
+}
+
 static inline void termkey_key_get_linecol(const TermKeyKey *key, int *line, int *col)
 {
   if(col)
@@ -106,6 +231,16 @@ static inline void termkey_key_set_linecol(TermKeyKey *key, int line, int col)
   key->code.mouse[3] = (line & 0xf00) >> 8 | (col & 0x300) >> 4;
 }
 
+/* Calls fn with each fixed byte sequence the CSI driver always decodes as the
+ * same key, for the terminfo driver to merge into its trie */
+void termkey_csi_foreach_key(void (*fn)(const char *seq, const struct keyinfo *info, void *data), void *data);
+
+#ifdef TERMKEY_MKBUILTIN
+# include <stdio.h>
+/* Writes the keys tk loaded from terminfo as a builtin table; for mkbuiltin.c */
+int termkey_ti_dump_builtin(TermKey *tk, FILE *out, int index);
+#endif
+
 extern struct TermKeyDriver termkey_driver_csi;
 extern struct TermKeyDriver termkey_driver_ti;
 
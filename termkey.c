@@ -4,11 +4,19 @@
 #include <ctype.h>
 #include <errno.h>
 #ifndef _WIN32
+# include <fcntl.h>
 # include <poll.h>
 # include <unistd.h>
 # include <strings.h>
+# include <sys/uio.h>
 #endif
+#include <stdint.h>
 #include <string.h>
+#if defined(__SSE2__) || defined(_M_X64)
+# include <emmintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+# include <arm_neon.h>
+#endif
 
 #include <stdio.h>
 
@@ -120,8 +128,6 @@ static struct {
 // Mouse event names
 static const char *evnames[] = { "Unknown", "Press", "Drag", "Release" };
 
-#define CHARAT(i) (tk->buffer[tk->buffstart + (i)])
-
 #ifdef DEBUG
 /* Some internal debugging functions */
 
@@ -174,6 +180,21 @@ static void print_key(TermKey *tk, TermKeyKey *key)
   case TERMKEY_TYPE_OSC:
     fprintf(stderr, "Operating System Control");
     break;
+  case TERMKEY_TYPE_PASTE:
+    fprintf(stderr, "Paste");
+    break;
+  case TERMKEY_TYPE_PASTE_START:
+    fprintf(stderr, "Paste start");
+    break;
+  case TERMKEY_TYPE_PASTE_DATA:
+    fprintf(stderr, "Paste data");
+    break;
+  case TERMKEY_TYPE_PASTE_END:
+    fprintf(stderr, "Paste end");
+    break;
+  case TERMKEY_TYPE_KITTYFLAGS:
+    fprintf(stderr, "Kitty keyboard flags=%d", key->code.number);
+    break;
   case TERMKEY_TYPE_UNKNOWN_CSI:
     fprintf(stderr, "unknown CSI\n");
     break;
@@ -284,12 +305,27 @@ static TermKey *termkey_alloc(void)
   tk->fd         = -1;
   tk->flags      = 0;
   tk->canonflags = 0;
+  tk->kittyflags = 0;
 
   tk->buffer    = NULL;
   tk->buffstart = 0;
   tk->buffcount = 0;
   tk->buffsize  = 256; /* bytes */
-  tk->hightide  = 0;
+  tk->buffbase  = 256;
+  tk->bufflimit = 0;
+  tk->buffpeak  = 0;
+  tk->buffhighwater = 0;
+  tk->buffquiet = 0;
+  tk->fd_nonblocking = 0;
+  tk->buffquietpeak = 0;
+  tk->buffpos   = 0;
+
+  tk->readbudget = 0;
+
+  tk->forced.valid = 0;
+
+  tk->driver_pending = 0;
+  tk->driver_deferred = 0;
 
 #ifdef HAVE_TERMIOS
   tk->restore_termios_valid = 0;
@@ -489,6 +525,73 @@ void termkey_hook_terminfo_getstr(TermKey *tk, TermKey_Terminfo_Getstr_Hook *hoo
   tk->ti_getstr_hook_data = data;
 }
 
+/* driverbytes[b] has bit i set if driver i might begin a key at byte b, so
+ * keys are only offered to those drivers and termkey_gettext() knows where
+ * plain text has to stop. Drivers past the eighth share the top bit
+ */
+#define DRIVER_BIT(i) (1 << ((i) < 7 ? (i) : 7))
+
+static void note_driver_bytes(TermKey *tk)
+{
+  tk->driver_claims_text = 0;
+
+  for(int b = 0; b < 256; b++) {
+    tk->driverbytes[b] = 0;
+
+    struct TermKeyDriverNode *p;
+    int i = 0;
+    for(p = tk->drivers; p; p = p->next, i++)
+      if(!p->driver->may_start || (*p->driver->may_start)(tk, p->info, b))
+        tk->driverbytes[b] |= DRIVER_BIT(i);
+
+    if(tk->driverbytes[b] && b >= 0x20 && b != 0x7f && (b < 0x80 || b >= 0xa0))
+      tk->driver_claims_text = 1;
+  }
+}
+
+/* Lets the drivers that put off loading their keys do so now. Returns true if
+ * any of them loaded something, so it's worth asking them all again
+ */
+static int load_deferred(TermKey *tk)
+{
+  int loaded = 0;
+
+  tk->driver_deferred = 0;
+
+  struct TermKeyDriverNode *p;
+  for(p = tk->drivers; p; p = p->next)
+    if(p->driver->load_deferred && (*p->driver->load_deferred)(tk, p->info))
+      loaded = 1;
+
+  if(loaded)
+    note_driver_bytes(tk);
+
+  return loaded;
+}
+
+/* Whether the buffer starts with a CSI or SS3 introducer, so anything there
+ * that no driver recognised was an escape sequence rather than Alt+key
+ */
+static int starts_escape_sequence(TermKey *tk)
+{
+  unsigned char b0 = CHARAT(0);
+
+  if(b0 == 0x9b || b0 == 0x8f)
+    return 1;
+
+  return b0 == 0x1b && tk->buffcount > 1 && (CHARAT(1) == '[' || CHARAT(1) == 'O');
+}
+
+static int is_nonblocking(int fd)
+{
+#ifndef _WIN32
+  int flags = fcntl(fd, F_GETFL);
+  return flags != -1 && (flags & O_NONBLOCK);
+#else
+  return 0;
+#endif
+}
+
 int termkey_start(TermKey *tk)
 {
   if(tk->is_started)
@@ -537,6 +640,12 @@ int termkey_start(TermKey *tk)
       if(!(*p->driver->start_driver)(tk, p->info))
         return 0;
 
+  note_driver_bytes(tk);
+
+  /* Checked here rather than on every read, so TERMKEY_FLAG_DRAIN costs no
+   * extra syscall */
+  tk->fd_nonblocking = tk->fd != -1 && is_nonblocking(tk->fd);
+
 #ifdef DEBUG
   fprintf(stderr, "Drivers started; termkey instance %p is ready\n", tk);
 #endif
@@ -584,6 +693,9 @@ void termkey_set_flags(TermKey *tk, int newflags)
 {
   tk->flags = newflags;
 
+  if(tk->flags & TERMKEY_FLAG_DRAIN)
+    tk->fd_nonblocking = tk->fd != -1 && is_nonblocking(tk->fd);
+
   if(tk->flags & TERMKEY_FLAG_SPACESYMBOL)
     tk->canonflags |= TERMKEY_CANON_SPACESYMBOL;
   else
@@ -620,18 +732,130 @@ size_t termkey_get_buffer_size(TermKey *tk)
   return tk->buffsize;
 }
 
-int termkey_set_buffer_size(TermKey *tk, size_t size)
+static int resize_buffer(TermKey *tk, size_t size)
 {
-  unsigned char *buffer = realloc(tk->buffer, size);
+  unsigned char *buffer = malloc(size);
   if(!buffer)
     return 0;
 
+  /* Unwrap the pending bytes to the start of the new buffer */
+  if(tk->buffcount > size)
+    tk->buffcount = size;
+  termkey_buffer_copy(tk, 0, tk->buffcount, buffer);
+
+  free(tk->buffer);
   tk->buffer = buffer;
+  tk->buffstart = 0;
   tk->buffsize = size;
 
   return 1;
 }
 
+int termkey_set_buffer_size(TermKey *tk, size_t size)
+{
+  if(!resize_buffer(tk, size))
+    return 0;
+
+  tk->buffbase = size;
+
+  return 1;
+}
+
+size_t termkey_get_buffer_limit(TermKey *tk)
+{
+  return tk->bufflimit;
+}
+
+void termkey_set_buffer_limit(TermKey *tk, size_t size)
+{
+  tk->bufflimit = size;
+}
+
+size_t termkey_get_buffer_highwater(TermKey *tk)
+{
+  return tk->buffhighwater;
+}
+
+size_t termkey_get_read_budget(TermKey *tk)
+{
+  return tk->readbudget;
+}
+
+void termkey_set_read_budget(TermKey *tk, size_t budget)
+{
+  tk->readbudget = budget;
+}
+
+/* Grow an adaptive buffer geometrically so it has room for at least another
+ * want bytes, as far as the limit allows. Returns false if it didn't grow at all
+ */
+static int grow_buffer(TermKey *tk, size_t want)
+{
+  size_t size = tk->buffsize;
+
+  if(!size || size >= tk->bufflimit)
+    return 0;
+
+  while(size - tk->buffcount < want && size < tk->bufflimit)
+    size *= 2;
+
+  if(size > tk->bufflimit)
+    size = tk->bufflimit;
+
+  return resize_buffer(tk, size);
+}
+
+/* An adaptive buffer only shrinks after this many drains in a row that all
+ * would have fitted in a smaller one */
+#define SHRINK_AFTER_DRAINS 8
+
+/* The smallest size that would comfortably hold peak bytes */
+static size_t buffer_size_for(TermKey *tk, size_t peak)
+{
+  size_t size = tk->buffbase;
+
+  while(size < peak * 2 && size < tk->buffsize)
+    size *= 2;
+
+  return size;
+}
+
+/* Called when the buffer has been drained. Once input has stayed small for a
+ * while, shrinks an adaptive buffer back down to the smallest size that would
+ * comfortably have held those bursts, so that idle instances don't keep a
+ * large buffer. A single large burst starts the count again, so alternating
+ * bursts don't resize the buffer every time
+ */
+static void shrink_buffer(TermKey *tk)
+{
+  if(tk->buffsize > tk->buffbase && tk->buffbase && tk->buffcount == 0) {
+    if(buffer_size_for(tk, tk->buffpeak) < tk->buffsize) {
+      if(tk->buffpeak > tk->buffquietpeak)
+        tk->buffquietpeak = tk->buffpeak;
+
+      if(++tk->buffquiet >= SHRINK_AFTER_DRAINS) {
+        resize_buffer(tk, buffer_size_for(tk, tk->buffquietpeak));
+        tk->buffquiet = 0;
+        tk->buffquietpeak = 0;
+      }
+    }
+    else {
+      tk->buffquiet = 0;
+      tk->buffquietpeak = 0;
+    }
+  }
+
+  tk->buffpeak = tk->buffcount;
+}
+
+static void note_buffer_filled(TermKey *tk)
+{
+  if(tk->buffcount > tk->buffpeak)
+    tk->buffpeak = tk->buffcount;
+  if(tk->buffcount > tk->buffhighwater)
+    tk->buffhighwater = tk->buffcount;
+}
+
 size_t termkey_get_buffer_remaining(TermKey *tk)
 {
   /* Return the total number of free bytes in the buffer, because that's what
@@ -642,12 +866,16 @@ size_t termkey_get_buffer_remaining(TermKey *tk)
 static void eat_bytes(TermKey *tk, size_t count)
 {
   if(count >= tk->buffcount) {
+    tk->buffpos += tk->buffcount;
     tk->buffstart = 0;
     tk->buffcount = 0;
     return;
   }
 
+  tk->buffpos += count;
   tk->buffstart += count;
+  if(tk->buffstart >= tk->buffsize)
+    tk->buffstart -= tk->buffsize;
   tk->buffcount -= count;
 }
 
@@ -687,79 +915,104 @@ static void fill_utf8(TermKeyKey *key)
 }
 
 #define UTF8_INVALID 0xFFFD
+
+/* The decoder is driven by these tables rather than by comparing the leading
+ * byte against each range in turn. Bytes that can't start a sequence (a
+ * continuation, or 0xFE/0xFF) have length 0
+ */
+static const unsigned char utf8_seqlen_by_lead[256] = {
+  1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+  1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+  1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+  1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+  1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+  1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+  1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+  1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2,
+  2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2,
+  3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3,
+  4, 4, 4, 4, 4, 4, 4, 4, 5, 5, 5, 5, 6, 6, 0, 0,
+};
+
+static const unsigned char utf8_lead_mask[7] = {
+  0, 0x7f, 0x1f, 0x0f, 0x07, 0x03, 0x01,
+};
+
+/* Smallest codepoint that needs a sequence of each length; anything below
+ * that is overlong
+ */
+static const long utf8_min_by_seqlen[7] = {
+  0, 0, 0x80, 0x800, 0x10000, 0x200000, 0x4000000,
+};
+
 static TermKeyResult parse_utf8(const unsigned char *bytes, size_t len, long *cp, size_t *nbytep)
 {
-  unsigned int nbytes;
-
   unsigned char b0 = bytes[0];
+  unsigned int nbytes = utf8_seqlen_by_lead[b0];
 
-  if(b0 < 0x80) {
-    // Single byte ASCII
-    *cp = b0;
-    *nbytep = 1;
-    return TERMKEY_RES_KEY;
-  }
-  else if(b0 < 0xc0) {
-    // Starts with a continuation byte - that's not right
-    *cp = UTF8_INVALID;
+  if(nbytes <= 1) {
+    // Single byte ASCII, or a byte that can't start a sequence
+    *cp = nbytes ? b0 : UTF8_INVALID;
     *nbytep = 1;
     return TERMKEY_RES_KEY;
   }
-  else if(b0 < 0xe0) {
-    nbytes = 2;
-    *cp = b0 & 0x1f;
-  }
-  else if(b0 < 0xf0) {
-    nbytes = 3;
-    *cp = b0 & 0x0f;
-  }
-  else if(b0 < 0xf8) {
-    nbytes = 4;
-    *cp = b0 & 0x07;
-  }
-  else if(b0 < 0xfc) {
-    nbytes = 5;
-    *cp = b0 & 0x03;
-  }
-  else if(b0 < 0xfe) {
-    nbytes = 6;
-    *cp = b0 & 0x01;
+
+  unsigned int avail = len < nbytes ? len : nbytes;
+  unsigned int bad = 0; // Index of the first byte that isn't a continuation
+  long c = b0 & utf8_lead_mask[nbytes];
+
+  /* Look at every byte that is present rather than stopping at a bad one, so
+   * the loop only depends on the sequence length
+   */
+  for(unsigned int b = 1; b < avail; b++) {
+    unsigned char cb = bytes[b];
+    bad += (!bad & ((cb & 0xc0) != 0x80)) * b;
+    c = (c << 6) | (cb & 0x3f);
   }
-  else {
+
+  if(bad) {
     *cp = UTF8_INVALID;
-    *nbytep = 1;
+    *nbytep = bad;
     return TERMKEY_RES_KEY;
   }
 
-  for(unsigned int b = 1; b < nbytes; b++) {
-    unsigned char cb;
+  if(avail < nbytes)
+    return TERMKEY_RES_AGAIN;
 
-    if(b >= len)
-      return TERMKEY_RES_AGAIN;
+  // Reject overlong sequences, UTF-16 surrogates and the two noncharacters
+  int invalid = (c < utf8_min_by_seqlen[nbytes]) |
+                ((unsigned long)(c - 0xD800) <= 0x7FF) |
+                ((c | 1) == 0xFFFF);
 
-    cb = bytes[b];
-    if(cb < 0x80 || cb >= 0xc0) {
-      *cp = UTF8_INVALID;
-      *nbytep = b;
-      return TERMKEY_RES_KEY;
-    }
+  *cp = invalid ? UTF8_INVALID : c;
+  *nbytep = nbytes;
+  return TERMKEY_RES_KEY;
+}
 
-    *cp <<= 6;
-    *cp |= cb & 0x3f;
-  }
+/* Decodes complete sequences from the start of bytes, storing up to max
+ * codepoints and the length of the sequence each came from. Stops early at an
+ * incomplete sequence. Returns the number decoded
+ */
+static size_t parse_utf8_bulk(const unsigned char *bytes, size_t len, long cps[], unsigned char nbytes[], size_t max)
+{
+  size_t n = 0;
+  size_t pos = 0;
 
-  // Check for overlong sequences
-  if(nbytes > utf8_seqlen(*cp))
-    *cp = UTF8_INVALID;
+  while(n < max && pos < len) {
+    size_t seqlen;
+    if(parse_utf8(bytes + pos, len - pos, &cps[n], &seqlen) != TERMKEY_RES_KEY)
+      break;
 
-  // Check for UTF-16 surrogates or invalid *cps
-  if((*cp >= 0xD800 && *cp <= 0xDFFF) ||
-     *cp == 0xFFFE ||
-     *cp == 0xFFFF)
-    *cp = UTF8_INVALID;
+    nbytes[n++] = seqlen;
+    pos += seqlen;
+  }
 
-  *nbytep = nbytes;
-  return TERMKEY_RES_KEY;
+  return n;
 }
 
 static void emit_codepoint(TermKey *tk, long codepoint, TermKeyKey *key)
@@ -852,32 +1105,67 @@ void termkey_canonicalise(TermKey *tk, TermKeyKey *key)
       key->code.sym = TERMKEY_SYM_BACKSPACE;
     }
   }
+
+  if(!(flags & TERMKEY_CANON_LOCKMODS))
+    key->modifiers &= ~(TERMKEY_KEYMOD_CAPSLOCK|TERMKEY_KEYMOD_NUMLOCK);
 }
 
+static TermKeyResult peekkey_drivers(TermKey *tk, TermKeyKey *key, int force, size_t *nbytep);
+
 static TermKeyResult peekkey(TermKey *tk, TermKeyKey *key, int force, size_t *nbytep)
 {
-  int again = 0;
-
   if(!tk->is_started) {
     errno = EINVAL;
     return TERMKEY_RES_ERROR;
   }
 
+  return peekkey_drivers(tk, key, force, nbytep);
+}
+
+/* As peekkey() but without checking the instance is started; for callers that
+ * have already done so */
+static TermKeyResult peekkey_drivers(TermKey *tk, TermKeyKey *key, int force, size_t *nbytep)
+{
+  int again;
+
 #ifdef DEBUG
   fprintf(stderr, "getkey(force=%d): buffer ", force);
   print_buffer(tk);
   fprintf(stderr, "\n");
 #endif
 
-  if(tk->hightide) {
-    tk->buffstart += tk->hightide;
-    tk->buffcount -= tk->hightide;
-    tk->hightide = 0;
-  }
-
   TermKeyResult ret;
   struct TermKeyDriverNode *p;
-  for(p = tk->drivers; p; p = p->next) {
+  unsigned char mask;
+  int i;
+  int alt = 0; // Decoding the key after an Escape taken as an Alt prefix
+
+retry:
+  again = 0;
+  key->event = TERMKEY_KEYEVENT_PRESS;
+
+  /* A driver part way through something, such as a paste, gets first claim
+   * on the bytes that continue it */
+  if(tk->driver_pending && !alt)
+    for(p = tk->drivers; p; p = p->next) {
+      if(!p->driver->peekkey_pending)
+        continue;
+
+      ret = (p->driver->peekkey_pending)(tk, p->info, key, force, nbytep);
+      if(ret != TERMKEY_RES_NONE)
+        goto done;
+    }
+
+  /* Only ask the drivers that might claim the first byte; with none, it goes
+   * straight to peekkey_simple() */
+  mask = 0xff;
+  if(!tk->driver_pending)
+    mask = tk->buffcount ? tk->driverbytes[CHARAT(0)] : 0;
+
+  for(p = mask ? tk->drivers : NULL, i = 0; p; p = p->next, i++) {
+    if(!(mask & DRIVER_BIT(i)))
+      continue;
+
     ret = (p->driver->peekkey)(tk, p->info, key, force, nbytep);
 
 #ifdef DEBUG
@@ -889,20 +1177,12 @@ static TermKeyResult peekkey(TermKey *tk, TermKeyKey *key, int force, size_t *nb
 #ifdef DEBUG
       print_key(tk, key); fprintf(stderr, "\n");
 #endif
-      // Slide the data down to stop it running away
-      {
-        size_t halfsize = tk->buffsize / 2;
-
-        if(tk->buffstart > halfsize) {
-          memcpy(tk->buffer, tk->buffer + halfsize, halfsize);
-          tk->buffstart -= halfsize;
-        }
-      }
-
+      if(key->type == TERMKEY_TYPE_UNKNOWN_CSI && tk->driver_deferred && load_deferred(tk))
+        goto retry;
       /* fallthrough */
     case TERMKEY_RES_EOF:
     case TERMKEY_RES_ERROR:
-      return ret;
+      goto done;
 
     case TERMKEY_RES_AGAIN:
       if(!force)
@@ -914,8 +1194,23 @@ static TermKeyResult peekkey(TermKey *tk, TermKeyKey *key, int force, size_t *nb
     }
   }
 
-  if(again)
-    return TERMKEY_RES_AGAIN;
+  if(again) {
+    ret = TERMKEY_RES_AGAIN;
+    goto done;
+  }
+
+  if(tk->driver_deferred && tk->buffcount && starts_escape_sequence(tk) && load_deferred(tk))
+    goto retry;
+
+  /* An Escape-prefixed value might be Alt+key, so try another key after it.
+   * Only the first Escape is taken as a prefix; any after that are keys in
+   * their own right, so a long run of them is decoded without recursion, a
+   * pair at a time */
+  if(!alt && tk->buffcount > 1 && CHARAT(0) == 0x1b) {
+    termkey_buffer_skip(tk, 1);
+    alt = 1;
+    goto retry;
+  }
 
   ret = peekkey_simple(tk, key, force, nbytep);
 
@@ -926,6 +1221,16 @@ static TermKeyResult peekkey(TermKey *tk, TermKeyKey *key, int force, size_t *nb
   }
 #endif
 
+done:
+  if(alt) {
+    termkey_buffer_unskip(tk, 1);
+
+    if(ret == TERMKEY_RES_KEY) {
+      key->modifiers |= TERMKEY_KEYMOD_ALT;
+      (*nbytep)++;
+    }
+  }
+
   return ret;
 }
 
@@ -936,43 +1241,15 @@ static TermKeyResult peekkey_simple(TermKey *tk, TermKeyKey *key, int force, siz
 
   unsigned char b0 = CHARAT(0);
 
-  if(b0 == 0x1b) {
-    // Escape-prefixed value? Might therefore be Alt+key
-    if(tk->buffcount == 1) {
-      // This might be an <Esc> press, or it may want to be part of a longer
-      // sequence
-      if(!force)
-        return TERMKEY_RES_AGAIN;
-
-      (*tk->method.emit_codepoint)(tk, b0, key);
-      *nbytep = 1;
-      return TERMKEY_RES_KEY;
-    }
-
-    // Try another key there
-    tk->buffstart++;
-    tk->buffcount--;
-
-    // Run the full driver
-    TermKeyResult metakey_result = peekkey(tk, key, force, nbytep);
-
-    tk->buffstart--;
-    tk->buffcount++;
-
-    switch(metakey_result) {
-      case TERMKEY_RES_KEY:
-        key->modifiers |= TERMKEY_KEYMOD_ALT;
-        (*nbytep)++;
-        break;
-
-      case TERMKEY_RES_NONE:
-      case TERMKEY_RES_EOF:
-      case TERMKEY_RES_AGAIN:
-      case TERMKEY_RES_ERROR:
-        break;
-    }
+  if(b0 == 0x1b && tk->buffcount == 1) {
+    // This might be an <Esc> press, or it may want to be part of a longer
+    // sequence; peekkey_drivers() has already tried it as an Alt prefix
+    if(!force)
+      return TERMKEY_RES_AGAIN;
 
-    return metakey_result;
+    (*tk->method.emit_codepoint)(tk, b0, key);
+    *nbytep = 1;
+    return TERMKEY_RES_KEY;
   }
   else if(b0 < 0xa0) {
     // Single byte C0, G0 or C1 - C1 is never UTF-8 initial byte
@@ -983,7 +1260,20 @@ static TermKeyResult peekkey_simple(TermKey *tk, TermKeyKey *key, int force, siz
   else if(tk->flags & TERMKEY_FLAG_UTF8) {
     // Some UTF-8
     long codepoint;
-    TermKeyResult res = parse_utf8(tk->buffer + tk->buffstart, tk->buffcount, &codepoint, nbytep);
+    const unsigned char *bytes = tk->buffer + tk->buffstart;
+    size_t len = tk->buffcount;
+    unsigned char wrapped[6];
+
+    if(tk->buffstart + len > tk->buffsize) {
+      // The sequence might wrap around the end of the ring, so take a copy
+      // of as much as a sequence can need
+      if(len > sizeof wrapped)
+        len = sizeof wrapped;
+      termkey_buffer_copy(tk, 0, len, wrapped);
+      bytes = wrapped;
+    }
+
+    TermKeyResult res = parse_utf8(bytes, len, &codepoint, nbytep);
 
     if(res == TERMKEY_RES_AGAIN && force) {
       /* There weren't enough bytes for a complete UTF-8 sequence but caller
@@ -1034,6 +1324,43 @@ static TermKeyResult peekkey_mouse(TermKey *tk, TermKeyKey *key, size_t *nbytep)
   return TERMKEY_RES_KEY;
 }
 
+/* As peekkey_drivers() in force mode, for a buffer the drivers said was
+ * incomplete. Until more bytes arrive the answer won't change, so it is kept
+ * for the next call; typically getkey_force() after getkey() has said AGAIN
+ */
+static TermKeyResult peekkey_forced(TermKey *tk, TermKeyKey *key, size_t *nbytep)
+{
+  if(tk->forced.valid &&
+     tk->forced.buffpos == tk->buffpos && tk->forced.buffcount == tk->buffcount &&
+     tk->forced.flags == tk->flags && tk->forced.canonflags == tk->canonflags) {
+    *key = tk->forced.key;
+    *nbytep = tk->forced.nbytes;
+    return TERMKEY_RES_KEY;
+  }
+
+  size_t buffpos = tk->buffpos, buffcount = tk->buffcount;
+
+  TermKeyResult ret = peekkey_drivers(tk, key, 1, nbytep);
+
+  /* Other types of event keep their details in the instance, so must be
+   * decoded again to be read again */
+  tk->forced.valid = ret == TERMKEY_RES_KEY &&
+    (key->type == TERMKEY_TYPE_UNICODE ||
+     key->type == TERMKEY_TYPE_KEYSYM ||
+     key->type == TERMKEY_TYPE_FUNCTION);
+
+  if(tk->forced.valid) {
+    tk->forced.buffpos    = buffpos;
+    tk->forced.buffcount  = buffcount;
+    tk->forced.flags      = tk->flags;
+    tk->forced.canonflags = tk->canonflags;
+    tk->forced.nbytes     = *nbytep;
+    tk->forced.key        = *key;
+  }
+
+  return ret;
+}
+
 TermKeyResult termkey_getkey(TermKey *tk, TermKeyKey *key)
 {
   size_t nbytes = 0;
@@ -1043,24 +1370,302 @@ TermKeyResult termkey_getkey(TermKey *tk, TermKeyKey *key)
     eat_bytes(tk, nbytes);
 
   if(ret == TERMKEY_RES_AGAIN)
-    /* Call peekkey() again in force mode to obtain whatever it can */
-    (void)peekkey(tk, key, 1, &nbytes);
+    /* Obtain whatever force mode would give */
+    (void)peekkey_forced(tk, key, &nbytes);
     /* Don't eat it yet though */
 
+  if(ret == TERMKEY_RES_NONE)
+    shrink_buffer(tk);
+
   return ret;
 }
 
 TermKeyResult termkey_getkey_force(TermKey *tk, TermKeyKey *key)
 {
   size_t nbytes = 0;
-  TermKeyResult ret = peekkey(tk, key, 1, &nbytes);
+
+  if(!tk->is_started) {
+    errno = EINVAL;
+    return TERMKEY_RES_ERROR;
+  }
+
+  TermKeyResult ret = peekkey_forced(tk, key, &nbytes);
 
   if(ret == TERMKEY_RES_KEY)
     eat_bytes(tk, nbytes);
 
+  if(ret == TERMKEY_RES_NONE)
+    shrink_buffer(tk);
+
   return ret;
 }
 
+static TermKeyResult getkeys(TermKey *tk, TermKeyKey *keys, size_t max, size_t *nkeysp)
+{
+  size_t nkeys = 0;
+  TermKeyResult ret = TERMKEY_RES_KEY;
+
+  while(nkeys < max) {
+    size_t nbytes = 0;
+    ret = peekkey_drivers(tk, &keys[nkeys], 0, &nbytes);
+
+    if(ret != TERMKEY_RES_KEY)
+      break;
+
+    eat_bytes(tk, nbytes);
+    nkeys++;
+
+    /* These events keep their details in the instance until the next key is
+     * read, so one of them must always end the batch */
+    if(keys[nkeys-1].type == TERMKEY_TYPE_UNKNOWN_CSI ||
+       keys[nkeys-1].type == TERMKEY_TYPE_DCS ||
+       keys[nkeys-1].type == TERMKEY_TYPE_OSC ||
+       keys[nkeys-1].type == TERMKEY_TYPE_PASTE ||
+       keys[nkeys-1].type == TERMKEY_TYPE_PASTE_DATA)
+      break;
+  }
+
+  *nkeysp = nkeys;
+
+  if(ret == TERMKEY_RES_AGAIN) {
+    size_t nbytes;
+    /* As for termkey_getkey(), leave an indication of what force mode would
+     * return in the next slot, without counting it or eating it */
+    (void)peekkey_forced(tk, &keys[nkeys], &nbytes);
+  }
+
+  /* If the array filled up or the batch was cut short, ret is still RES_KEY
+   * because more may follow. Otherwise it describes whatever remains in the
+   * buffer after the keys */
+  return ret;
+}
+
+TermKeyResult termkey_getkeys(TermKey *tk, TermKeyKey *keys, size_t max, size_t *nkeysp)
+{
+  *nkeysp = 0;
+
+  if(!tk->is_started) {
+    errno = EINVAL;
+    return TERMKEY_RES_ERROR;
+  }
+
+  TermKeyResult ret = getkeys(tk, keys, max, nkeysp);
+
+  if(ret == TERMKEY_RES_NONE)
+    shrink_buffer(tk);
+
+  return ret;
+}
+
+/* Returns how many of the len bytes at p are printable ASCII; that is, above
+ * lo and below DEL. Whole blocks are checked with vector instructions where
+ * the platform is known to have them, then the rest a byte at a time
+ */
+static size_t scan_ascii_text(const unsigned char *p, size_t len, unsigned char lo)
+{
+  size_t i = 0;
+
+#if defined(__SSE2__) || defined(_M_X64)
+  /* Signed comparisons also reject any byte with the top bit set */
+  const __m128i above = _mm_set1_epi8(lo);
+  const __m128i below = _mm_set1_epi8(0x7f);
+
+  for(; i + 16 <= len; i += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i *)(p + i));
+    __m128i ok = _mm_and_si128(_mm_cmpgt_epi8(v, above), _mm_cmplt_epi8(v, below));
+    if(_mm_movemask_epi8(ok) != 0xffff)
+      break;
+  }
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+  const uint8x16_t above = vdupq_n_u8(lo);
+  const uint8x16_t below = vdupq_n_u8(0x7f);
+
+  for(; i + 16 <= len; i += 16) {
+    uint8x16_t v = vld1q_u8(p + i);
+    uint8x16_t ok = vandq_u8(vcgtq_u8(v, above), vcltq_u8(v, below));
+    if(vminvq_u8(ok) == 0)
+      break;
+  }
+#endif
+
+  while(i < len && p[i] > lo && p[i] < 0x7f)
+    i++;
+
+  return i;
+}
+
+/* Returns the length of the longest run at the start of the len bytes at p,
+ * made of characters that peekkey_simple() would return as unmodified
+ * Unicode keys, and that no driver might treat as the start of something else
+ */
+static size_t text_run(TermKey *tk, const unsigned char *p, size_t len)
+{
+  // With SPACESYMBOL, space is a keysym rather than text
+  unsigned char lo = (tk->canonflags & TERMKEY_CANON_SPACESYMBOL) ? 0x20 : 0x1f;
+  size_t i = 0;
+
+  while(i < len) {
+    if(!tk->driver_claims_text) {
+      i += scan_ascii_text(p + i, len - i, lo);
+      if(i == len)
+        break;
+    }
+
+    unsigned char b = p[i];
+
+    if(b <= lo || b == 0x7f || (b >= 0x80 && b < 0xa0) || tk->driverbytes[b])
+      break;
+
+    if(!(tk->flags & TERMKEY_FLAG_UTF8)) {
+      i++;
+      continue;
+    }
+
+    long codepoints[16];
+    unsigned char nbytes[16];
+    size_t n = parse_utf8_bulk(p + i, len - i, codepoints, nbytes, 16);
+    if(!n)
+      break;
+
+    for(size_t k = 0; k < n; k++) {
+      long codepoint = codepoints[k];
+
+      if(codepoint < 0x80 ? (codepoint <= lo || codepoint == 0x7f)
+                          : (codepoint < 0xa0 || codepoint == UTF8_INVALID))
+        return i;
+      if(tk->driverbytes[p[i]])
+        return i;
+
+      i += nbytes[k];
+    }
+  }
+
+  return i;
+}
+
+TermKeyResult termkey_gettext(TermKey *tk, const char **strp, size_t *lenp)
+{
+  *lenp = 0;
+
+  if(!tk->is_started) {
+    errno = EINVAL;
+    return TERMKEY_RES_ERROR;
+  }
+
+  if(tk->buffcount == 0)
+    return tk->is_closed ? TERMKEY_RES_EOF : TERMKEY_RES_NONE;
+
+  /* A driver might still want the first byte, such as one in the middle of a
+   * paste; only the drivers themselves know. Otherwise text_run() stops at
+   * any byte a driver might claim */
+  if(tk->driver_pending) {
+    struct TermKeyDriverNode *p;
+    for(p = tk->drivers; p; p = p->next) {
+      TermKeyKey key;
+      size_t nbytes;
+      if((p->driver->peekkey)(tk, p->info, &key, 0, &nbytes) != TERMKEY_RES_NONE)
+        return TERMKEY_RES_NONE;
+    }
+  }
+
+  /* Only look as far as the end of the ring, so the run can be returned
+   * without copying */
+  const unsigned char *bytes = tk->buffer + tk->buffstart;
+  size_t len = tk->buffsize - tk->buffstart;
+  if(len > tk->buffcount)
+    len = tk->buffcount;
+
+  len = text_run(tk, bytes, len);
+  if(!len)
+    return TERMKEY_RES_NONE;
+
+  *strp = (const char *)bytes;
+  *lenp = len;
+  eat_bytes(tk, len);
+
+  return TERMKEY_RES_KEY;
+}
+
+size_t termkey_decode_bytes(TermKey *tk, const char *bytes, size_t len, TermKeyKey *keys, size_t max, size_t *nkeysp)
+{
+  size_t consumed = 0;
+  size_t nkeys = 0;
+  size_t step = 16;
+  size_t got;
+  TermKeyResult ret;
+
+  *nkeysp = 0;
+
+  if(!tk->is_started) {
+    errno = EINVAL;
+    return (size_t)-1;
+  }
+
+  /* Anything already in the buffer, such as a partial sequence left from the
+   * last call, has to be decoded first. Feed the new bytes in behind it a
+   * little at a time until the buffer drains */
+  while(tk->buffcount && consumed < len && nkeys < max) {
+    size_t n = len - consumed;
+    if(n > step)
+      n = step;
+
+    n = termkey_push_bytes(tk, bytes + consumed, n);
+    if(n == (size_t)-1) {
+      consumed = n;
+      goto done;
+    }
+    consumed += n;
+
+    ret = getkeys(tk, keys + nkeys, max - nkeys, &got);
+    nkeys += got;
+    if(ret == TERMKEY_RES_KEY)
+      goto done;
+
+    step *= 2;
+  }
+
+  if(tk->buffcount || consumed == len || nkeys == max)
+    goto done;
+
+  /* The buffer is empty, so point it at the caller's bytes and decode them in
+   * place. Nothing writes through tk->buffer while decoding, and eat_bytes()
+   * leaves it empty or partly consumed, never wrapped */
+  unsigned char *buffer = tk->buffer;
+  size_t buffsize = tk->buffsize;
+
+  tk->buffer    = (unsigned char *)bytes + consumed;
+  tk->buffstart = 0;
+  tk->buffcount = len - consumed;
+  tk->buffsize  = len - consumed;
+
+  ret = getkeys(tk, keys + nkeys, max - nkeys, &got);
+  nkeys += got;
+
+  size_t remaining = tk->buffcount;
+
+  tk->buffer    = buffer;
+  tk->buffstart = 0;
+  tk->buffcount = 0;
+  tk->buffsize  = buffsize;
+
+  consumed = len - remaining;
+
+  /* Only copy what the next call will need from the buffer: an incomplete
+   * trailing sequence. Anything else is left for the caller to pass in again
+   */
+  if(ret == TERMKEY_RES_AGAIN && remaining) {
+    size_t n = termkey_push_bytes(tk, bytes + consumed, remaining);
+    if(n == (size_t)-1)
+      consumed = n;
+    else
+      consumed += n;
+  }
+
+done:
+  *nkeysp = nkeys;
+  return consumed;
+}
+
 #ifndef _WIN32
 TermKeyResult termkey_waitkey(TermKey *tk, TermKeyKey *key)
 {
@@ -1123,28 +1728,45 @@ retry:
 }
 #endif
 
-TermKeyResult termkey_advisereadable(TermKey *tk)
+/* Perform one read into the free space of the ring, of at most max bytes. On
+ * systems that have it this is a single readv() into both free segments;
+ * otherwise only the segment following the valid bytes is filled
+ */
+static TermKeyResult read_buffer(TermKey *tk, size_t max)
 {
   ssize_t len;
 
-  if(tk->fd == -1) {
-    errno = EBADF;
-    return TERMKEY_RES_ERROR;
+  /* Free space starts after the valid bytes and runs as far as either the end
+   * of the ring or the start of the valid bytes. If the valid bytes don't
+   * wrap, there may be more free space at the start of the ring */
+  size_t head = tk->buffstart + tk->buffcount;
+  size_t room, more = 0;
+  if(head >= tk->buffsize) {
+    head -= tk->buffsize;
+    room = tk->buffstart - head;
   }
-
-  if(tk->buffstart) {
-    memmove(tk->buffer, tk->buffer + tk->buffstart, tk->buffcount);
-    tk->buffstart = 0;
+  else {
+    room = tk->buffsize - head;
+    more = tk->buffstart;
   }
 
-  /* Not expecting it ever to be greater but doesn't hurt to handle that */
-  if(tk->buffcount >= tk->buffsize) {
-    errno = ENOMEM;
-    return TERMKEY_RES_ERROR;
-  }
+  if(room > max)
+    room = max;
+  if(more > max - room)
+    more = max - room;
 
 retry:
-  len = read(tk->fd, tk->buffer + tk->buffcount, tk->buffsize - tk->buffcount);
+#ifndef _WIN32
+  if(more) {
+    struct iovec iov[2] = {
+      { .iov_base = tk->buffer + head, .iov_len = room },
+      { .iov_base = tk->buffer,        .iov_len = more },
+    };
+    len = readv(tk->fd, iov, 2);
+  }
+  else
+#endif
+    len = read(tk->fd, tk->buffer + head, room);
 
   if(len == -1) {
     if(errno == EAGAIN)
@@ -1160,17 +1782,57 @@ retry:
   }
   else {
     tk->buffcount += len;
+    note_buffer_filled(tk);
     return TERMKEY_RES_AGAIN;
   }
 }
 
-size_t termkey_push_bytes(TermKey *tk, const char *bytes, size_t len)
+TermKeyResult termkey_advisereadable(TermKey *tk)
 {
-  if(tk->buffstart) {
-    memmove(tk->buffer, tk->buffer + tk->buffstart, tk->buffcount);
-    tk->buffstart = 0;
+  if(tk->fd == -1) {
+    errno = EBADF;
+    return TERMKEY_RES_ERROR;
   }
 
+  /* Not expecting it ever to be greater but doesn't hurt to handle that */
+  if(tk->buffcount >= tk->buffsize && !grow_buffer(tk, 1)) {
+    errno = ENOMEM;
+    return TERMKEY_RES_ERROR;
+  }
+
+  /* A blocking filehandle is read only once; a second read would wait for
+   * more input, even though whole keys may already be in the buffer */
+  if(!(tk->flags & TERMKEY_FLAG_DRAIN) || !tk->fd_nonblocking)
+    return read_buffer(tk, SIZE_MAX);
+
+  /* Keep reading until the filehandle runs dry, the budget is spent, or the
+   * buffer is full and can't grow any further. In the last case the caller
+   * has to take some keys out before calling again */
+  size_t total = 0;
+
+  while(!tk->readbudget || total < tk->readbudget) {
+    if(tk->buffcount >= tk->buffsize && !grow_buffer(tk, 1))
+      break;
+
+    size_t before = tk->buffcount;
+    TermKeyResult ret = read_buffer(tk, tk->readbudget ? tk->readbudget - total : SIZE_MAX);
+
+    if(ret == TERMKEY_RES_ERROR)
+      return ret;
+    if(ret == TERMKEY_RES_NONE)
+      break;
+
+    total += tk->buffcount - before;
+  }
+
+  return total ? TERMKEY_RES_AGAIN : TERMKEY_RES_NONE;
+}
+
+size_t termkey_push_bytes(TermKey *tk, const char *bytes, size_t len)
+{
+  if(len > tk->buffsize - tk->buffcount)
+    grow_buffer(tk, len);
+
   /* Not expecting it ever to be greater but doesn't hurt to handle that */
   if(tk->buffcount >= tk->buffsize) {
     errno = ENOMEM;
@@ -1180,9 +1842,19 @@ size_t termkey_push_bytes(TermKey *tk, const char *bytes, size_t len)
   if(len > tk->buffsize - tk->buffcount)
     len = tk->buffsize - tk->buffcount;
 
+  size_t head = tk->buffstart + tk->buffcount;
+  if(head >= tk->buffsize)
+    head -= tk->buffsize;
+
+  size_t first = tk->buffsize - head;
+  if(first > len)
+    first = len;
+
   // memcpy(), not strncpy() in case of null bytes in input
-  memcpy(tk->buffer + tk->buffcount, bytes, len);
+  memcpy(tk->buffer + head, bytes, first);
+  memcpy(tk->buffer, bytes + first, len - first);
   tk->buffcount += len;
+  note_buffer_filled(tk);
 
   return len;
 }
@@ -1292,17 +1964,17 @@ size_t termkey_snprint_key(TermKey *tk, char *buffer, size_t len, TermKeyKey *ke
 }
 
 static struct modnames {
-  const char *shift, *alt, *ctrl;
+  const char *shift, *alt, *ctrl, *super, *hyper, *meta;
 }
 modnames[] = {
-  { "S",     "A",    "C" },    // 0
-  { "Shift", "Alt",  "Ctrl" }, // LONGMOD
-  { "S",     "M",    "C" },    // ALTISMETA
-  { "Shift", "Meta", "Ctrl" }, // ALTISMETA+LONGMOD
-  { "s",     "a",    "c" },    // LOWERMOD
-  { "shift", "alt",  "ctrl" }, // LOWERMOD+LONGMOD
-  { "s",     "m",    "c" },    // LOWERMOD+ALTISMETA
-  { "shift", "meta", "ctrl" }, // LOWERMOD+ALTISMETA+LONGMOD
+  { "S",     "A",    "C",    "D",     "H",     "T"        }, // 0
+  { "Shift", "Alt",  "Ctrl", "Super", "Hyper", "Meta"     }, // LONGMOD
+  { "S",     "M",    "C",    "D",     "H",     "T"        }, // ALTISMETA
+  { "Shift", "Meta", "Ctrl", "Super", "Hyper", "TrueMeta" }, // ALTISMETA+LONGMOD
+  { "s",     "a",    "c",    "d",     "h",     "t"        }, // LOWERMOD
+  { "shift", "alt",  "ctrl", "super", "hyper", "meta"     }, // LOWERMOD+LONGMOD
+  { "s",     "m",    "c",    "d",     "h",     "t"        }, // LOWERMOD+ALTISMETA
+  { "shift", "meta", "ctrl", "super", "hyper", "truemeta" }, // LOWERMOD+ALTISMETA+LONGMOD
 };
 
 size_t termkey_strfkey(TermKey *tk, char *buffer, size_t len, TermKeyKey *key, TermKeyFormat format)
@@ -1346,6 +2018,24 @@ size_t termkey_strfkey(TermKey *tk, char *buffer, size_t len, TermKeyKey *key, T
     pos += l;
   }
 
+  if(key->modifiers & TERMKEY_KEYMOD_SUPER) {
+    l = snprintf(buffer + pos, len - pos, "%s%c", mods->super, sep);
+    if(l <= 0) return pos;
+    pos += l;
+  }
+
+  if(key->modifiers & TERMKEY_KEYMOD_HYPER) {
+    l = snprintf(buffer + pos, len - pos, "%s%c", mods->hyper, sep);
+    if(l <= 0) return pos;
+    pos += l;
+  }
+
+  if(key->modifiers & TERMKEY_KEYMOD_META) {
+    l = snprintf(buffer + pos, len - pos, "%s%c", mods->meta, sep);
+    if(l <= 0) return pos;
+    pos += l;
+  }
+
   if(key->modifiers & TERMKEY_KEYMOD_ALT) {
     l = snprintf(buffer + pos, len - pos, "%s%c", mods->alt, sep);
     if(l <= 0) return pos;
@@ -1419,6 +2109,21 @@ size_t termkey_strfkey(TermKey *tk, char *buffer, size_t len, TermKeyKey *key, T
   case TERMKEY_TYPE_OSC:
     l = snprintf(buffer + pos, len - pos, "OSC");
     break;
+  case TERMKEY_TYPE_PASTE:
+    l = snprintf(buffer + pos, len - pos, "Paste");
+    break;
+  case TERMKEY_TYPE_PASTE_START:
+    l = snprintf(buffer + pos, len - pos, "PasteStart");
+    break;
+  case TERMKEY_TYPE_PASTE_DATA:
+    l = snprintf(buffer + pos, len - pos, "PasteData");
+    break;
+  case TERMKEY_TYPE_PASTE_END:
+    l = snprintf(buffer + pos, len - pos, "PasteEnd");
+    break;
+  case TERMKEY_TYPE_KITTYFLAGS:
+    l = snprintf(buffer + pos, len - pos, "KittyFlags(%d)", key->code.number);
+    break;
   case TERMKEY_TYPE_UNKNOWN_CSI:
     l = snprintf(buffer + pos, len - pos, "CSI %c", key->code.number & 0xff);
     break;
@@ -1443,6 +2148,7 @@ const char *termkey_strpkey(TermKey *tk, const char *str, TermKeyKey *key, TermK
                                     !!(format & TERMKEY_FORMAT_LOWERMOD) * 4];
 
   key->modifiers = 0;
+  key->event = TERMKEY_KEYEVENT_PRESS;
 
   if((format & TERMKEY_FORMAT_CARETCTRL) && str[0] == '^' && str[1]) {
     str = termkey_strpkey(tk, str+1, key, format & ~TERMKEY_FORMAT_CARETCTRL);
@@ -1471,6 +2177,12 @@ const char *termkey_strpkey(TermKey *tk, const char *str, TermKeyKey *key, TermK
       key->modifiers |= TERMKEY_KEYMOD_CTRL;
     else if(n == strlen(mods->shift) && strncmp(mods->shift, str, n) == 0)
       key->modifiers |= TERMKEY_KEYMOD_SHIFT;
+    else if(n == strlen(mods->super) && strncmp(mods->super, str, n) == 0)
+      key->modifiers |= TERMKEY_KEYMOD_SUPER;
+    else if(n == strlen(mods->hyper) && strncmp(mods->hyper, str, n) == 0)
+      key->modifiers |= TERMKEY_KEYMOD_HYPER;
+    else if(n == strlen(mods->meta) && strncmp(mods->meta, str, n) == 0)
+      key->modifiers |= TERMKEY_KEYMOD_META;
 
     else
       break;
@@ -1563,6 +2275,7 @@ int termkey_keycmp(TermKey *tk, const TermKeyKey *key1p, const TermKeyKey *key2p
         return key1.code.sym - key2.code.sym;
       break;
     case TERMKEY_TYPE_FUNCTION:
+    case TERMKEY_TYPE_KITTYFLAGS:
     case TERMKEY_TYPE_UNKNOWN_CSI:
       if(key1.code.number != key2.code.number)
         return key1.code.number - key2.code.number;
@@ -1586,7 +2299,12 @@ int termkey_keycmp(TermKey *tk, const TermKeyKey *key1p, const TermKeyKey *key2p
       break;
     case TERMKEY_TYPE_DCS:
     case TERMKEY_TYPE_OSC:
+    case TERMKEY_TYPE_PASTE:
+    case TERMKEY_TYPE_PASTE_DATA:
       return key1p - key2p;
+    case TERMKEY_TYPE_PASTE_START:
+    case TERMKEY_TYPE_PASTE_END:
+      break;
     case TERMKEY_TYPE_MODEREPORT:
       {
         int initial1, initial2, mode1, mode2, value1, value2;